@@ -0,0 +1,103 @@
+#ifndef RK_SQLLITE_AGGREGATE_H
+#define RK_SQLLITE_AGGREGATE_H
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include "Batch.h"
+
+enum AggregateFunction {
+  AGGREGATE_COUNT,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_SUM
+};
+
+constexpr uint32_t MAX_AGGREGATES = 4;
+
+/*
+ * Running count(*), min(id), max(id) and sum(id) over the rows seen so
+ * far. All four are kept whichever were asked for, since one pass over the
+ * ids gives them together. The sum wraps around at 2^64 like the id type.
+ * */
+struct AggregateState {
+  uint64_t count;
+  TableKey min;
+  TableKey max;
+  TableKey sum;
+};
+
+AggregateState aggregate_init() {
+  return {0, std::numeric_limits<TableKey>::max(),
+          std::numeric_limits<TableKey>::min(), 0};
+}
+
+/*
+ * Fold the selected rows of batch in. When every row is selected the loops
+ * run straight over the id column, which the compiler turns into vector
+ * min/max/add; otherwise the ids are gathered through the selection.
+ * */
+void aggregate_batch(AggregateState &state, const RowBatch &batch) {
+  TableKey min = state.min;
+  TableKey max = state.max;
+  TableKey sum = state.sum;
+  if (batch.num_selected == batch.size) {
+    for (uint32_t i = 0; i < batch.size; i++) {
+      min = std::min(min, batch.ids[i]);
+      max = std::max(max, batch.ids[i]);
+      sum += batch.ids[i];
+    }
+  } else {
+    for (uint32_t i = 0; i < batch.num_selected; i++) {
+      TableKey id = batch.ids[batch.selection[i]];
+      min = std::min(min, id);
+      max = std::max(max, id);
+      sum += id;
+    }
+  }
+  state.count += batch.num_selected;
+  state.min = min;
+  state.max = max;
+  state.sum = sum;
+}
+
+void aggregate_merge(AggregateState &state, const AggregateState &other) {
+  state.count += other.count;
+  state.min = std::min(state.min, other.min);
+  state.max = std::max(state.max, other.max);
+  state.sum += other.sum;
+}
+
+/*
+ * One row with the asked for aggregates in order. min and max of no rows
+ * are NULL.
+ * */
+void aggregate_print(const AggregateState &state,
+                     const AggregateFunction *functions,
+                     uint32_t num_functions) {
+  std::cout << "(";
+  for (uint32_t i = 0; i < num_functions; i++) {
+    if (i > 0) {
+      std::cout << ", ";
+    }
+    switch (functions[i]) {
+      case AGGREGATE_COUNT:
+        std::cout << state.count;
+        break;
+      case AGGREGATE_MIN:
+      case AGGREGATE_MAX:
+        if (state.count == 0) {
+          std::cout << "NULL";
+        } else {
+          std::cout << (functions[i] == AGGREGATE_MIN ? state.min : state.max);
+        }
+        break;
+      case AGGREGATE_SUM:
+        std::cout << state.sum;
+        break;
+    }
+  }
+  std::cout << ")" << std::endl;
+}
+
+#endif //RK_SQLLITE_AGGREGATE_H
@@ -0,0 +1,63 @@
+#ifndef RK_SQLLITE_ARENA_H
+#define RK_SQLLITE_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/*
+ * Bump allocator for many small allocations that are freed together.
+ * Memory is taken from the heap a block at a time and handed out from the
+ * last block in order. arena_reset frees everything at once and keeps the
+ * first block, so an arena that is reset and reused stops allocating once
+ * its first block is big enough.
+ * */
+constexpr size_t ARENA_BLOCK_SIZE = 16 * 1024;
+
+struct ArenaBlock {
+  std::unique_ptr<std::byte[]> bytes;
+  size_t size;
+};
+
+struct Arena {
+  std::vector<ArenaBlock> blocks;
+  size_t used; // bytes handed out from the last block.
+  size_t total; // bytes in all blocks.
+};
+
+void *arena_allocate(Arena &arena,
+                     size_t size,
+                     size_t alignment = alignof(std::max_align_t)) {
+  size_t offset = (arena.used + alignment - 1) & ~(alignment - 1);
+  if (arena.blocks.empty() || offset + size > arena.blocks.back().size) {
+    size_t block_size = std::max(ARENA_BLOCK_SIZE, size);
+    arena.blocks.push_back({std::unique_ptr<std::byte[]>(
+                                new std::byte[block_size]),
+                            block_size});
+    arena.total += block_size;
+    offset = 0;
+  }
+  arena.used = offset + size;
+  return arena.blocks.back().bytes.get() + offset;
+}
+
+/*
+ * A value initialized T in the arena. Nothing runs its destructor, so T
+ * should not need one.
+ * */
+template<typename T>
+T *arena_new(Arena &arena) {
+  return new(arena_allocate(arena, sizeof(T), alignof(T))) T{};
+}
+
+void arena_reset(Arena &arena) {
+  if (arena.blocks.size() > 1) {
+    arena.blocks.resize(1);
+  }
+  arena.used = 0;
+  arena.total = arena.blocks.empty() ? 0 : arena.blocks.front().size;
+}
+
+#endif //RK_SQLLITE_ARENA_H
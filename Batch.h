@@ -0,0 +1,129 @@
+#ifndef RK_SQLLITE_BATCH_H
+#define RK_SQLLITE_BATCH_H
+
+#include "Cursor.h"
+#include "Row.h"
+#include "StringMatch.h"
+
+/*
+ * Batch execution for scans.
+ *
+ * Rows are pulled out of the leaves a block at a time into column vectors:
+ * the ids, copied from the cell keys, and a reference to each serialized
+ * row for the string columns, which stay in the page. Filters then run over
+ * the whole block and narrow a selection vector of row positions, and the
+ * output step prints only what is left. Each step is a short loop over
+ * arrays instead of a trip through the cursor functions per row.
+ * */
+constexpr uint32_t BATCH_SIZE = 1024;
+
+struct RowBatch {
+  Pager *pager;
+  uint32_t size;
+  TableKey ids[BATCH_SIZE];
+  const std::byte *rows[BATCH_SIZE];
+  // Positions of the rows that passed every filter so far, in order.
+  uint16_t selection[BATCH_SIZE];
+  uint32_t num_selected;
+};
+
+/*
+ * Fill batch with the rows from cursor on, a leaf run at a time, and
+ * select all of them. Leaves for which leaf_may_match(leaf) is false are
+ * stepped over without reading a row. Loading stops before the leaf
+ * end_page_num, if not 0. Returns false once there are no rows left to
+ * load.
+ * */
+template<typename LeafFilter>
+bool batch_load(Cursor *cursor,
+                RowBatch &batch,
+                LeafFilter leaf_may_match,
+                uint32_t end_page_num = 0) {
+  using Layout = LeafNodeLayout<TableKey>;
+  batch.pager = cursor->table->pager;
+  batch.size = 0;
+
+  while (batch.size < BATCH_SIZE && !(cursor->end_of_table)
+      && cursor->page_num != end_page_num) {
+    std::byte *leaf = batch.pager->get_page(cursor->page_num);
+    if (cursor->cell_num == 0 && !leaf_may_match(leaf)) {
+      cursor_skip_leaf(cursor);
+      continue;
+    }
+
+    uint32_t num_cells = *leaf_node_num_cells(leaf);
+    uint32_t count = std::min(num_cells - cursor->cell_num,
+                              BATCH_SIZE - batch.size);
+    auto *cell = static_cast<std::byte *>(
+        leaf_node_cell<TableKey>(leaf, cursor->cell_num));
+    for (uint32_t i = 0; i < count; i++) {
+      batch.ids[batch.size + i] =
+          KeyTraits<TableKey>::load(cell + Layout::KEY_OFFSET);
+      batch.rows[batch.size + i] = cell + Layout::VALUE_OFFSET;
+      cell += Layout::CELL_SIZE;
+    }
+    batch.size += count;
+
+    cursor->cell_num += count;
+    cursor_skip_exhausted_leaf(cursor);
+  }
+
+  for (uint32_t i = 0; i < batch.size; i++) {
+    batch.selection[i] = i;
+  }
+  batch.num_selected = batch.size;
+  return batch.size > 0;
+}
+
+bool batch_load(Cursor *cursor, RowBatch &batch) {
+  return batch_load(cursor, batch, [](std::byte *) { return true; });
+}
+
+/*
+ * Keep the selected rows with low <= id <= high. Every row is written to
+ * the selection and the count only moves past the ones that match, so the
+ * loop has no branch on the data.
+ * */
+void batch_filter_id_range(RowBatch &batch, TableKey low, TableKey high) {
+  uint32_t num_selected = 0;
+  for (uint32_t i = 0; i < batch.num_selected; i++) {
+    uint16_t row = batch.selection[i];
+    batch.selection[num_selected] = row;
+    num_selected += (batch.ids[row] >= low) & (batch.ids[row] <= high);
+  }
+  batch.num_selected = num_selected;
+}
+
+/*
+ * Keep the selected rows whose username, or email, matches pattern. The
+ * match runs on the bytes in the leaf.
+ * */
+void batch_filter_username(RowBatch &batch, const StringPattern &pattern) {
+  uint32_t num_selected = 0;
+  for (uint32_t i = 0; i < batch.num_selected; i++) {
+    uint16_t row = batch.selection[i];
+    batch.selection[num_selected] = row;
+    num_selected += row_view_username_matches(
+        row_view(batch.rows[row], batch.pager), pattern);
+  }
+  batch.num_selected = num_selected;
+}
+
+void batch_filter_email(RowBatch &batch, const StringPattern &pattern) {
+  uint32_t num_selected = 0;
+  for (uint32_t i = 0; i < batch.num_selected; i++) {
+    uint16_t row = batch.selection[i];
+    batch.selection[num_selected] = row;
+    num_selected += row_view_email_matches(
+        row_view(batch.rows[row], batch.pager), pattern);
+  }
+  batch.num_selected = num_selected;
+}
+
+void batch_print(const RowBatch &batch, std::ostream &out = std::cout) {
+  for (uint32_t i = 0; i < batch.num_selected; i++) {
+    print_row_view(row_view(batch.rows[batch.selection[i]], batch.pager), out);
+  }
+}
+
+#endif //RK_SQLLITE_BATCH_H
@@ -3,64 +3,466 @@
 //
 #ifndef RK_SQLLITE_CURSOR_H
 #define RK_SQLLITE_CURSOR_H
+#include <iterator>
+#include <vector>
 #include "Table.h"
 #include "Row.h"
 #include "Node.h"
 
+/*
+ * One internal node on the way from the root to the cursor's leaf: the
+ * page, the child slot taken in it and its latch version at the time.
+ * */
+struct CursorPathEntry {
+  uint32_t page_num;
+  uint32_t child_index;
+  uint64_t version;
+};
+
+// The pager's page limit keeps the tree far shallower than this.
+constexpr uint32_t CURSOR_MAX_DEPTH = 8;
+
 struct Cursor {
   Table *table;
   uint32_t page_num;
   uint32_t cell_num;
   bool end_of_table;
+  // path[0] is the root and path[depth - 1] the leaf's parent. depth is 0
+  // for a leaf root, or when the path is not known.
+  CursorPathEntry path[CURSOR_MAX_DEPTH];
+  uint32_t depth;
 };
 
+/*
+ * Append an internal node the cursor went through to its path.
+ * */
+void cursor_push_path(Cursor *cursor, uint32_t page_num, uint32_t child_index) {
+  if (cursor->depth >= CURSOR_MAX_DEPTH) {
+    std::cout << "Tree is deeper than CURSOR_MAX_DEPTH." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  PageLatch &latch = cursor->table->latches[page_num];
+  cursor->path[cursor->depth++] = {
+      page_num, child_index, latch.version.load(std::memory_order_acquire)};
+}
+
+/*
+ * True when the page behind path entry level has not changed since the
+ * cursor went through it, so its keys and child slots can be reused.
+ * */
+bool cursor_path_valid(Cursor *cursor, uint32_t level) {
+  CursorPathEntry &entry = cursor->path[level];
+  return latch_read_validate(cursor->table->latches[entry.page_num],
+                             entry.version);
+}
+
+template<typename Key>
 void create_new_root(Table &table, uint32_t right_child_page_num);
 
+template<typename Key>
+Cursor table_find(Table *table, KeyArg<Key> key);
 
-Cursor *table_start(Table *table) {
-  Cursor *cursor = static_cast<Cursor *> (malloc(sizeof(Cursor)));
-  cursor->table = table;
-  cursor->page_num = table->root_page_num;
-  cursor->cell_num = 0;
+template<typename Key = TableKey>
+void leaf_node_find(Cursor *cursor, uint32_t page_num, KeyArg<Key> key);
+
+/*
+ * Drop the search index of an internal node whose keys are changing.
+ * Expects the page to be write latched.
+ * */
+void table_drop_internal_search(Table *table, uint32_t page_num) {
+  table->internal_search[page_num].is_built.store(false,
+                                                  std::memory_order_release);
+  table->internal_search[page_num].misses.store(0, std::memory_order_relaxed);
+}
 
-//  void *root_node = get_page(table->pager, table->root_page_num);
-  std::byte *root_node = table->pager->get_page(table->root_page_num);
-  uint32_t num_cells = *leaf_node_num_cells(root_node);
-  cursor->end_of_table = (num_cells == 0);
+/*
+ * Ordered reads walk the cells of a leaf by position, so its append region
+ * has to be merged in first. Latched, as lookups on other threads may be
+ * reading the leaf.
+ * */
+template<typename Key = TableKey>
+void cursor_sort_leaf(Cursor *cursor) {
+  std::byte *node = cursor->table->pager->get_page(cursor->page_num);
+  if (*leaf_node_num_unsorted(node) == 0) {
+    return;
+  }
 
+  PageLatch &latch = cursor->table->latches[cursor->page_num];
+  latch_write_lock(latch);
+  leaf_node_merge_unsorted<Key>(node);
+  latch_write_unlock(latch);
+}
+
+/*
+ * table_find for a cursor that is going to be advanced: its leaf is sorted
+ * and the cursor is where key is or would go in key order.
+ * */
+template<typename Key = TableKey>
+Cursor table_seek(Table *table, KeyArg<Key> key) {
+  Cursor cursor = table_find<Key>(table, key);
+  std::byte *node = table->pager->get_page(cursor.page_num);
+  if (*leaf_node_num_unsorted(node) > 0) {
+    cursor_sort_leaf<Key>(&cursor);
+    leaf_node_find<Key>(&cursor, cursor.page_num, key);
+  }
   return cursor;
 }
 
-Cursor *table_end(Table *table) {
-  Cursor *cursor = static_cast<Cursor *> (malloc(sizeof(Cursor)));
-  cursor->table = table;
-  cursor->page_num = table->root_page_num;
-  std::byte *root_node = table->pager->get_page(table->root_page_num);
-  uint32_t num_cells = *leaf_node_num_cells(root_node);
-  cursor->cell_num = num_cells;
-  cursor->end_of_table = true;
+template<typename Key = TableKey>
+Cursor table_start(Table *table) {
+  // The leftmost cell is where the smallest key would be.
+  Cursor cursor = table_seek<Key>(table, KeyTraits<Key>::min());
+
+  std::byte *node = table->pager->get_page(cursor.page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  cursor.end_of_table = (num_cells == 0);
 
   return cursor;
 }
 
+/*
+ * One past the last row: on the rightmost leaf, after its last cell, with
+ * the path down the rightmost children, so cursor_retreat can walk back
+ * from it.
+ * */
+template<typename Key = TableKey>
+Cursor table_end(Table *table) {
+  Cursor cursor{};
+  cursor.table = table;
+  cursor.depth = 0;
+  cursor.page_num = table->root_page_num;
+  std::byte *node = table->pager->get_page(cursor.page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    cursor_push_path(&cursor, cursor.page_num, *internal_node_num_keys(node));
+    cursor.page_num = *internal_node_right_child(node);
+    node = table->pager->get_page(cursor.page_num);
+  }
+  cursor_sort_leaf<Key>(&cursor);
+  cursor.cell_num = *leaf_node_num_cells(node);
+  cursor.end_of_table = true;
+
+  return cursor;
+}
+
+/*
+ * Move the path on to the leaf right of the current one: go up to the
+ * nearest ancestor that has a child further right, step to it and then
+ * follow leftmost children down. If that does not end at next_page_num, or
+ * a page on the way changed, the path is dropped.
+ * */
+template<typename Key = TableKey>
+void cursor_path_next_leaf(Cursor *cursor, uint32_t next_page_num) {
+  Pager *pager = cursor->table->pager;
+  uint32_t level = cursor->depth;
+  if (level == 0) {
+    return;
+  }
+
+  while (level > 0) {
+    level--;
+    if (!cursor_path_valid(cursor, level)) {
+      cursor->depth = 0;
+      return;
+    }
+    std::byte *node = pager->get_page(cursor->path[level].page_num);
+    if (cursor->path[level].child_index < *internal_node_num_keys(node)) {
+      break;
+    }
+    if (level == 0) {
+      cursor->depth = 0;
+      return;
+    }
+  }
+
+  uint32_t depth = cursor->depth;
+  cursor->depth = level + 1;
+  cursor->path[level].child_index += 1;
+  std::byte *node = pager->get_page(cursor->path[level].page_num);
+  uint32_t page_num =
+      *internal_node_child<Key>(node, cursor->path[level].child_index);
+  while (cursor->depth < depth) {
+    cursor_push_path(cursor, page_num, 0);
+    page_num = *internal_node_child<Key>(pager->get_page(page_num), 0);
+  }
+
+  if (page_num != next_page_num) {
+    cursor->depth = 0;
+  }
+}
+
+/*
+ * Find the path to the cursor's leaf again with a descent for its first
+ * key. False if that does not end at the leaf.
+ * */
+template<typename Key = TableKey>
+bool cursor_rebuild_path(Cursor *cursor) {
+  std::byte *node = cursor->table->pager->get_page(cursor->page_num);
+  if (*leaf_node_num_cells(node) == 0) {
+    return false;
+  }
+  Cursor found = table_find<Key>(cursor->table, leaf_node_key<Key>(node, 0));
+  if (found.page_num != cursor->page_num) {
+    return false;
+  }
+  memcpy(cursor->path, found.path, sizeof(cursor->path));
+  cursor->depth = found.depth;
+  return true;
+}
+
+/*
+ * Move the cursor to the leaf left of the current one and return false if
+ * there is none. Leaves only link to the right, so this goes by the path:
+ * up to the nearest ancestor that has a child further left, step to it and
+ * then follow rightmost children down. A path that is unknown or out of
+ * date is found again first.
+ * */
+template<typename Key = TableKey>
+bool cursor_path_prev_leaf(Cursor *cursor) {
+  Pager *pager = cursor->table->pager;
+  bool path_valid = cursor->depth > 0;
+  for (uint32_t level = 0; level < cursor->depth && path_valid; level++) {
+    path_valid = cursor_path_valid(cursor, level);
+  }
+  if (!path_valid) {
+    if (is_node_root(pager->get_page(cursor->page_num))
+        || !cursor_rebuild_path<Key>(cursor)) {
+      return false;
+    }
+  }
+
+  uint32_t level = cursor->depth;
+  do {
+    if (level == 0) {
+      return false;
+    }
+    level--;
+  } while (cursor->path[level].child_index == 0);
+
+  uint32_t depth = cursor->depth;
+  cursor->depth = level + 1;
+  cursor->path[level].child_index -= 1;
+  std::byte *node = pager->get_page(cursor->path[level].page_num);
+  uint32_t page_num =
+      *internal_node_child<Key>(node, cursor->path[level].child_index);
+  while (cursor->depth < depth) {
+    node = pager->get_page(page_num);
+    cursor_push_path(cursor, page_num, *internal_node_num_keys(node));
+    page_num = *internal_node_right_child(node);
+  }
+
+  cursor->page_num = page_num;
+  cursor_sort_leaf<Key>(cursor);
+  return true;
+}
+
+/*
+ * Step back to the previous row, which from table_end is the last one.
+ * Stepping back from the first row leaves the cursor with end_of_table
+ * set, as the end of a walk to the left.
+ * */
+template<typename Key = TableKey>
+void cursor_retreat(Cursor *cursor) {
+  while (cursor->cell_num == 0) {
+    if (!cursor_path_prev_leaf<Key>(cursor)) {
+      cursor->end_of_table = true;
+      return;
+    }
+    std::byte *node = cursor->table->pager->get_page(cursor->page_num);
+    cursor->cell_num = *leaf_node_num_cells(node);
+  }
+  cursor->cell_num -= 1;
+  cursor->end_of_table = false;
+}
+
+template<typename Key = TableKey>
 void cursor_advance(Cursor *cursor) {
   uint32_t page_num = cursor->page_num;
   std::byte *node = cursor->table->pager->get_page(page_num);
   cursor->cell_num += 1;
   if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
+    // Move on to the right sibling, if there is one.
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      cursor->end_of_table = true;
+    } else {
+      cursor_path_next_leaf<Key>(cursor, next_page_num);
+      cursor->page_num = next_page_num;
+      cursor->cell_num = 0;
+      cursor_sort_leaf<Key>(cursor);
+    }
+  }
+}
+
+/*
+ * A seek can land one past the last cell of a leaf when the key is larger
+ * than everything stored there. Step over to the first cell of the next leaf
+ * (or the end of the table) so the cursor points at a real row.
+ * */
+template<typename Key = TableKey>
+void cursor_skip_exhausted_leaf(Cursor *cursor) {
+  std::byte *node = cursor->table->pager->get_page(cursor->page_num);
+  if (cursor->cell_num < *leaf_node_num_cells(node)) {
+    cursor->end_of_table = false;
+    return;
+  }
+
+  uint32_t next_page_num = *leaf_node_next_leaf(node);
+  if (next_page_num == 0) {
     cursor->end_of_table = true;
+  } else {
+    cursor_path_next_leaf<Key>(cursor, next_page_num);
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+    cursor->end_of_table = false;
+    cursor_sort_leaf<Key>(cursor);
+  }
+}
+
+/*
+ * Move to the first cell of the next leaf, passing over the rest of this
+ * one.
+ * */
+template<typename Key = TableKey>
+void cursor_skip_leaf(Cursor *cursor) {
+  std::byte *node = cursor->table->pager->get_page(cursor->page_num);
+  cursor->cell_num = *leaf_node_num_cells(node);
+  cursor_skip_exhausted_leaf<Key>(cursor);
+}
+
+/*
+ * Cursor on the row with the given zero based position in key order. Child
+ * row counts tell which subtree holds it, so only one root-to-leaf path is
+ * read. Past the last row the cursor is at the end of the table.
+ * */
+template<typename Key = TableKey>
+Cursor table_find_row(Table *table, uint32_t row_num) {
+  Cursor cursor{};
+  cursor.table = table;
+
+  uint32_t page_num = table->root_page_num;
+  std::byte *node = table->pager->get_page(page_num);
+
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t child_index = 0;
+    while (child_index < num_keys
+        && row_num >= *internal_node_child_count<Key>(node, child_index)) {
+      row_num -= *internal_node_child_count<Key>(node, child_index);
+      child_index++;
+    }
+    cursor_push_path(&cursor, page_num, child_index);
+    page_num = *internal_node_child<Key>(node, child_index);
+    node = table->pager->get_page(page_num);
   }
+
+  cursor.page_num = page_num;
+  cursor.cell_num = row_num;
+  cursor_sort_leaf<Key>(&cursor);
+  cursor_skip_exhausted_leaf<Key>(&cursor);
+  return cursor;
+}
+
+template<typename Key = TableKey>
+uint32_t table_row_count(Table *table) {
+  std::byte *root = table->pager->get_page(table->root_page_num);
+  uint32_t count = get_node_row_count<Key>(root);
+  // Buffered rows are not in any child's count yet.
+  if (table->write_buffering && get_node_type(root) == NODE_INTERNAL) {
+    count += *internal_node_buffer_count(root);
+  }
+  return count;
+}
+
+template<typename Key = TableKey>
+Key cursor_key(const Cursor *cursor) {
+  std::byte *page = cursor->table->pager->get_page(cursor->page_num);
+  return leaf_node_key<Key>(page, cursor->cell_num);
 }
 
-void *cursor_value(Cursor *cursor) {
+template<typename Key = TableKey>
+void *cursor_value(const Cursor *cursor) {
   uint32_t page_num = cursor->page_num;
   std::byte *page = cursor->table->pager->get_page(page_num);
-  return leaf_node_value(page, cursor->cell_num);
+  return leaf_node_value<Key>(page, cursor->cell_num);
 }
 
-bool is_node_root(std::byte *node) {
-  uint8_t value = *((uint8_t *) (node + IS_ROOT_OFFSET));
-  return (bool) value;
+/*
+ * Iterator over the rows of the table in key order, for range-for and the
+ * standard algorithms. It holds its cursor by value, so copies move on
+ * independently. Dereferencing gives the serialized row, which stays valid
+ * as long as its page is in the pager. Decrementing the end iterator gives
+ * the last row, so std::reverse_iterator walks the table backwards.
+ * */
+template<typename Key = TableKey>
+struct TableIterator {
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = std::byte *;
+  using difference_type = std::ptrdiff_t;
+  using pointer = std::byte **;
+  using reference = std::byte *;
+
+  Cursor cursor;
+
+  std::byte *operator*() const {
+    return static_cast<std::byte *>(cursor_value<Key>(&cursor));
+  }
+
+  TableIterator &operator++() {
+    cursor_advance<Key>(&cursor);
+    return *this;
+  }
+
+  TableIterator operator++(int) {
+    TableIterator previous = *this;
+    cursor_advance<Key>(&cursor);
+    return previous;
+  }
+
+  TableIterator &operator--() {
+    cursor_retreat<Key>(&cursor);
+    return *this;
+  }
+
+  TableIterator operator--(int) {
+    TableIterator next = *this;
+    cursor_retreat<Key>(&cursor);
+    return next;
+  }
+
+  // Every cursor at the end of the table is the same position.
+  bool operator==(const TableIterator &other) const {
+    if (cursor.end_of_table || other.cursor.end_of_table) {
+      return cursor.end_of_table == other.cursor.end_of_table;
+    }
+    return cursor.page_num == other.cursor.page_num
+        && cursor.cell_num == other.cursor.cell_num;
+  }
+
+  bool operator!=(const TableIterator &other) const {
+    return !(*this == other);
+  }
+};
+
+template<typename Key = TableKey>
+struct TableRange {
+  Table *table;
+
+  TableIterator<Key> begin() const {
+    return {table_start<Key>(table)};
+  }
+
+  TableIterator<Key> end() const {
+    return {table_end<Key>(table)};
+  }
+};
+
+/*
+ * All rows of the table: for (std::byte *row : table_rows(table)).
+ * */
+template<typename Key = TableKey>
+TableRange<Key> table_rows(Table *table) {
+  return {table};
 }
 
 void set_node_root(std::byte *node, bool is_root) {
@@ -68,17 +470,87 @@ void set_node_root(std::byte *node, bool is_root) {
   *((uint8_t *) (node + IS_ROOT_OFFSET)) = value;
 }
 
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
+template<typename Key>
+void internal_node_insert(Table *table,
+                          uint32_t parent_page_num,
+                          uint32_t child_page_num);
+
+/*
+ * A row with the given key was added below page_num. Bump the row count
+ * of every ancestor on the way up to the root; the key picks the slot the
+ * same way the descent did. For callers without a cursor.
+ * */
+template<typename Key = TableKey>
+void update_ancestor_row_counts(Table *table,
+                                uint32_t page_num,
+                                KeyArg<Key> key,
+                                int32_t delta) {
+  std::byte *node = table->pager->get_page(page_num);
+  while (!is_node_root(node)) {
+    std::byte *parent = table->pager->get_page(*node_parent(node));
+    uint32_t child_index = internal_node_find_child<Key>(parent, key);
+    *internal_node_child_count<Key>(parent, child_index) += delta;
+    node = parent;
+  }
+}
+
+/*
+ * Add delta to the row count kept for the cursor's subtree in the first
+ * depth nodes of its path. The path has the slots, so nothing is searched.
+ * */
+template<typename Key = TableKey>
+void cursor_update_ancestor_row_counts(Cursor *cursor,
+                                       uint32_t depth,
+                                       int32_t delta) {
+  for (uint32_t level = 0; level < depth; level++) {
+    CursorPathEntry &entry = cursor->path[level];
+    std::byte *node = cursor->table->pager->get_page(entry.page_num);
+    *internal_node_child_count<Key>(node, entry.child_index) += delta;
+  }
+}
+
+template<typename Key = TableKey>
+void leaf_node_split_and_insert(Cursor *cursor,
+                                KeyArg<Key> key,
+                                const std::byte *value) {
+  using Layout = LeafNodeLayout<Key>;
   std::cout << "leaf_node_split_and_insert called" << std::endl;
   /*
     Create a new node and move half of the cells over.
     Insert the new value in one of the two cells.
     Update parent or create new parent.
    * */
-  std::byte *old_node = cursor->table->pager->get_page(cursor->page_num);
-  uint32_t new_page_num = cursor->table->pager->get_unused_page_num();
-  std::byte *new_node = cursor->table->pager->get_page(new_page_num);
+  Pager *pager = cursor->table->pager;
+  std::byte *old_node = pager->get_page(cursor->page_num);
+
+  // The split below moves cells by position, so they have to be in order.
+  if (*leaf_node_num_unsorted(old_node) > 0) {
+    leaf_node_merge_unsorted<Key>(old_node);
+    leaf_node_find<Key>(cursor, cursor->page_num, key);
+  }
+
+  /*
+   Appending past the end of the rightmost leaf is what increasing keys do.
+   An even split there would leave every leaf behind the right edge half
+   empty for good, so keep the old leaf full and start the new one with just
+   the new cell.
+   */
+  bool is_rightmost = *leaf_node_next_leaf(old_node) == 0;
+  uint32_t left_split_count = Layout::LEFT_SPLIT_COUNT;
+  if (is_rightmost && cursor->cell_num == Layout::MAX_CELLS) {
+    left_split_count = Layout::MAX_CELLS;
+  }
+  uint32_t right_split_count = (Layout::MAX_CELLS + 1) - left_split_count;
+
+  uint32_t new_page_num = pager->get_unused_page_num();
+  std::byte *new_node = pager->get_page(new_page_num);
   initialize_leaf_node(new_node);
+  *node_parent(new_node) = *node_parent(old_node);
+  *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+  *leaf_node_next_leaf(old_node) = new_page_num;
+  if (is_rightmost) {
+    cursor->table->rightmost_leaf_page_num = new_page_num;
+  }
 
   std::cout << "New leaf node has been initialized" << std::endl;
 
@@ -88,115 +560,287 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
    position.
    */
 
-  for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
+  for (int32_t i = Layout::MAX_CELLS; i >= 0; i--) {
     std::cout << "Moving cell: " << i << std::endl;
     void *destination_node;
-    if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
+    uint32_t index_within_node;
+    if (i >= left_split_count) {
       destination_node = new_node;
+      index_within_node = i - left_split_count;
     } else {
       destination_node = old_node;
+      index_within_node = i;
     }
 
-    uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-    void *destination = leaf_node_cell(destination_node, index_within_node);
+    void *destination =
+        leaf_node_cell<Key>(destination_node, index_within_node);
 
     if (i == cursor->cell_num) {
-      serialize_row(*value, static_cast<std::byte *> (destination));
+      set_leaf_node_key<Key>(destination_node, index_within_node, key);
+      memcpy(leaf_node_value<Key>(destination_node, index_within_node), value,
+             Layout::VALUE_SIZE);
     } else if (i > cursor->cell_num) {
-      memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+      memcpy(destination, leaf_node_cell<Key>(old_node, i - 1),
+             Layout::CELL_SIZE);
     } else {
-      memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+      memcpy(destination, leaf_node_cell<Key>(old_node, i), Layout::CELL_SIZE);
     }
   }
 
   std::cout << "Data copy complete between the new and old node." << std::endl;
 
   /*Update cell count on both leaf nodes*/
-  *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-  *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+  *(leaf_node_num_cells(old_node)) = left_split_count;
+  *(leaf_node_num_cells(new_node)) = right_split_count;
+  leaf_node_zone_map_rebuild<Key>(old_node);
+  leaf_node_zone_map_rebuild<Key>(new_node);
 
   if (is_node_root(old_node)) {
-    return create_new_root(*cursor->table, new_page_num);
+    return create_new_root<Key>(*cursor->table, new_page_num);
   } else {
-    std::cout << "Need to implement updating parent after split" << std::endl;
+    // The cursor's path says where the old leaf hangs, no need to look.
+    CursorPathEntry &parent_entry = cursor->path[cursor->depth - 1];
+    uint32_t parent_page_num = parent_entry.page_num;
+    std::byte *parent = pager->get_page(parent_page_num);
+
+    // The right child has no key of its own.
+    if (parent_entry.child_index < *internal_node_num_keys(parent)) {
+      set_internal_node_key<Key>(parent, parent_entry.child_index,
+                                 get_node_max_key<Key>(pager, old_node));
+      table_drop_internal_search(cursor->table, parent_page_num);
+    }
+    internal_node_insert<Key>(cursor->table, parent_page_num, new_page_num);
+
+    // The new leaf went in right of the old one, which kept its slot.
+    *internal_node_child_count<Key>(parent, parent_entry.child_index) =
+        get_node_row_count<Key>(old_node);
+    cursor_update_ancestor_row_counts<Key>(cursor, cursor->depth - 1, 1);
   }
 }
 
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
+/*
+ * Insert the serialized row value under key at the cursor. The row is
+ * serialized by the caller, once, since that may take an overflow slot.
+ * */
+template<typename Key = TableKey>
+void leaf_node_insert(Cursor *cursor, KeyArg<Key> key, const std::byte *value) {
+  using Layout = LeafNodeLayout<Key>;
   std::byte *node = cursor->table->pager->get_page(cursor->page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
 
   std::cout << "Total number of cells in node: " << num_cells
-            << "\n Max Cells in a node: " << LEAF_NODE_MAX_CELLS << std::endl;
+            << "\n Max Cells in a node: " << Layout::MAX_CELLS << std::endl;
 
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    leaf_node_split_and_insert(cursor, key, value);
+  if (num_cells >= Layout::MAX_CELLS) {
+    leaf_node_split_and_insert<Key>(cursor, key, value);
     return;
   }
 
-  if (cursor->cell_num < num_cells) {
-    // Make room for the new cell.
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i),
-             leaf_node_cell(node, i - 1),
-             LEAF_NODE_CELL_SIZE);
+  /*
+   A key past the end of a fully sorted leaf can just be appended. Anything
+   else goes into the append region, which costs one cell write; the region
+   is only sorted in once it is full.
+   */
+  uint32_t num_unsorted = *leaf_node_num_unsorted(node);
+  if (cursor->cell_num < num_cells || num_unsorted > 0) {
+    if (num_unsorted >= LEAF_NODE_MAX_UNSORTED) {
+      leaf_node_merge_unsorted<Key>(node);
     }
+    *leaf_node_num_unsorted(node) += 1;
   }
 
+  cursor->cell_num = num_cells;
   *(leaf_node_num_cells(node)) += 1;
-  *(leaf_node_key(node, cursor->cell_num)) = key;
-  serialize_row(*value,
-                static_cast<std::byte *>(leaf_node_value(node,
-                                                         cursor->cell_num)));
+  set_leaf_node_key<Key>(node, cursor->cell_num, key);
+  auto *row = static_cast<std::byte *>(leaf_node_value<Key>(node,
+                                                            cursor->cell_num));
+  memcpy(row, value, Layout::VALUE_SIZE);
+  leaf_node_zone_map_add(node, row, num_cells == 0);
+  cursor_update_ancestor_row_counts<Key>(cursor, cursor->depth, 1);
 }
 
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
+template<typename Key>
+void leaf_node_find(Cursor *cursor, uint32_t page_num, KeyArg<Key> key) {
+  Table *table = cursor->table;
   std::byte *node = table->pager->get_page(page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
 
-  Cursor *cursor = static_cast<Cursor *>(malloc(sizeof(Cursor)));
-  cursor->table = table;
   cursor->page_num = page_num;
 
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
+  if (*leaf_node_next_leaf(node) == 0) {
+    table->rightmost_leaf_page_num = page_num;
+  }
 
-  while (one_past_max_index != min_index) {
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    uint32_t key_at_index = *leaf_node_key(node, index);
+  bool found;
+  cursor->cell_num = leaf_node_find_cell<Key>(node, key, found);
+}
 
-    if (key == key_at_index) {
-      cursor->cell_num = index;
-      return cursor;
-    }
+template<typename Key = TableKey>
+void internal_node_find(Cursor *cursor, uint32_t page_num, KeyArg<Key> key) {
+  Table *table = cursor->table;
+  std::byte *node = table->pager->get_page(page_num);
 
-    if (key < key_at_index) {
-      one_past_max_index = index;
-    } else {
-      min_index = index + 1;
-    }
+  uint32_t child_index = internal_node_find_child<Key>(node, key);
+  uint32_t child_num = *internal_node_child<Key>(node, child_index);
+  std::byte *child = table->pager->get_page(child_num);
+  cursor_push_path(cursor, page_num, child_index);
+
+  switch (get_node_type(child)) {
+    case NODE_LEAF:
+      return leaf_node_find<Key>(cursor, child_num, key);
+    case NODE_INTERNAL:
+    default:
+      return internal_node_find<Key>(cursor, child_num, key);
   }
+}
 
-  cursor->cell_num = min_index;
-  return cursor;
+/*
+ * Increasing keys all land after the last cell of the rightmost leaf. When
+ * the key is larger than everything in the table, go straight there instead
+ * of descending from the root. Returns false, leaving cursor alone, when
+ * the hint does not apply.
+ * */
+template<typename Key = TableKey>
+bool rightmost_leaf_find(Table *table, KeyArg<Key> key, Cursor *cursor) {
+  uint32_t page_num = table->rightmost_leaf_page_num;
+  if (page_num == 0) {
+    return false;
+  }
+
+  std::byte *node = table->pager->get_page(page_num);
+  if (get_node_type(node) != NODE_LEAF || *leaf_node_next_leaf(node) != 0) {
+    table->rightmost_leaf_page_num = 0;
+    return false;
+  }
+
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (num_cells == 0
+      || !key_less(get_node_max_key<Key>(table->pager, node), key)) {
+    return false;
+  }
+
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->cell_num = num_cells;
+  cursor->end_of_table = false;
+
+  // Every node above the rightmost leaf took its right child, so the path
+  // can be read off the parent pointers.
+  uint32_t ancestors[CURSOR_MAX_DEPTH];
+  uint32_t num_ancestors = 0;
+  while (!is_node_root(node) && num_ancestors < CURSOR_MAX_DEPTH) {
+    ancestors[num_ancestors++] = *node_parent(node);
+    node = table->pager->get_page(*node_parent(node));
+  }
+  cursor->depth = 0;
+  while (num_ancestors > 0) {
+    uint32_t ancestor_page_num = ancestors[--num_ancestors];
+    std::byte *ancestor = table->pager->get_page(ancestor_page_num);
+    cursor_push_path(cursor, ancestor_page_num,
+                     *internal_node_num_keys(ancestor));
+  }
+  return true;
 }
 
 /*
  * Return the position of the given key.
  * If the key is not present, return the position of where it should be found.
  * */
-Cursor *table_find(Table *table, uint32_t key) {
+template<typename Key = TableKey>
+Cursor table_find(Table *table, KeyArg<Key> key) {
+  Cursor cursor{};
+  if (rightmost_leaf_find<Key>(table, key, &cursor)) {
+    return cursor;
+  }
+
+  cursor.table = table;
+  cursor.end_of_table = false;
+  cursor.depth = 0;
+
   uint32_t root_page_num = table->root_page_num;
   std::byte *root_node = table->pager->get_page(root_page_num);
 
   if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
+    leaf_node_find<Key>(&cursor, root_page_num, key);
   } else {
-    std::cout << "Need to implement searching an internal node." << std::endl;
-    exit(EXIT_FAILURE);
+    internal_node_find<Key>(&cursor, root_page_num, key);
   }
+  return cursor;
 }
 
+/*
+ * Whether key falls in the subtree the cursor's path enters at level (the
+ * leaf when level is depth). The separators either side of the slot taken
+ * bound it; a missing side (leftmost or right child) is bounded further
+ * up. Separators only move when the node they bound splits, which changes
+ * the parent, so only nodes whose keys are read need an unchanged version.
+ * */
+template<typename Key = TableKey>
+bool cursor_path_contains(Cursor *cursor, uint32_t level, KeyArg<Key> key) {
+  bool has_lower_bound = false;
+  bool has_upper_bound = false;
+
+  for (uint32_t parent_level = level; parent_level > 0; parent_level--) {
+    if (has_lower_bound && has_upper_bound) {
+      break;
+    }
+
+    CursorPathEntry &entry = cursor->path[parent_level - 1];
+    if (!cursor_path_valid(cursor, parent_level - 1)) {
+      return false;
+    }
+    std::byte *node = cursor->table->pager->get_page(entry.page_num);
+
+    if (!has_upper_bound && entry.child_index < *internal_node_num_keys(node)) {
+      if (key_less(internal_node_key<Key>(node, entry.child_index), key)) {
+        return false;
+      }
+      has_upper_bound = true;
+    }
+    if (!has_lower_bound && entry.child_index > 0) {
+      if (!key_less(internal_node_key<Key>(node, entry.child_index - 1), key)) {
+        return false;
+      }
+      has_lower_bound = true;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Move cursor to key without starting over from the root. The lowest
+ * subtree on the cursor's path that still holds key is searched from, so a
+ * key near the last one usually costs one leaf search.
+ * */
+template<typename Key = TableKey>
+void cursor_seek(Cursor *cursor, KeyArg<Key> key) {
+  uint32_t level = cursor->depth;
+  while (level > 0 && !cursor_path_contains<Key>(cursor, level, key)) {
+    level--;
+  }
+
+  uint32_t page_num;
+  if (level == cursor->depth) {
+    page_num = cursor->page_num;
+  } else if (level == 0) {
+    page_num = cursor->table->root_page_num;
+  } else {
+    page_num = *internal_node_child<Key>(
+        cursor->table->pager->get_page(cursor->path[level - 1].page_num),
+        cursor->path[level - 1].child_index);
+  }
+  cursor->depth = level;
+  cursor->end_of_table = false;
+
+  std::byte *node = cursor->table->pager->get_page(page_num);
+  if (get_node_type(node) == NODE_LEAF) {
+    leaf_node_find<Key>(cursor, page_num, key);
+  } else {
+    internal_node_find<Key>(cursor, page_num, key);
+  }
+}
+
+template<typename Key = TableKey>
 void create_new_root(Table &table, uint32_t right_child_page_num) {
   /*
    Handle splitting the root.
@@ -215,9 +859,768 @@ void create_new_root(Table &table, uint32_t right_child_page_num) {
   memcpy(left_child, root, PAGE_SIZE);
   set_node_root(left_child, false);
 
-  // Initialize internal node
-  // initialize_internal_node(root);
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    // Children moved along with the old root, repoint them at their new home.
+    for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+      std::byte *child =
+          table.pager->get_page(*internal_node_child<Key>(left_child, i));
+      *node_parent(child) = left_child_page_num;
+    }
+  }
+
+  // Root node is a new internal node with one key and two children.
+  initialize_internal_node(root);
   set_node_root(root, true);
+  *internal_node_num_keys(root) = 1;
+  *internal_node_child<Key>(root, 0) = left_child_page_num;
+  Key left_child_max_key = get_node_max_key<Key>(table.pager, left_child);
+  set_internal_node_key<Key>(root, 0, left_child_max_key);
+  *internal_node_right_child(root) = right_child_page_num;
+  *internal_node_child_count<Key>(root, 0) =
+      get_node_row_count<Key>(left_child);
+  *internal_node_child_count<Key>(root, 1) =
+      get_node_row_count<Key>(right_child);
+  *node_parent(left_child) = table.root_page_num;
+  *node_parent(right_child) = table.root_page_num;
+  if (table.write_buffering) {
+    *internal_node_buffer_count(root) = 0;
+  }
+  table_drop_internal_search(&table, table.root_page_num);
+  table_drop_internal_search(&table, left_child_page_num);
+}
+
+/*
+ * Add a new child/key pair to the parent that corresponds to child.
+ * */
+template<typename Key = TableKey>
+void internal_node_insert(Table *table,
+                          uint32_t parent_page_num,
+                          uint32_t child_page_num) {
+  std::byte *parent = table->pager->get_page(parent_page_num);
+  std::byte *child = table->pager->get_page(child_page_num);
+  Key child_max_key = get_node_max_key<Key>(table->pager, child);
+  uint32_t index = internal_node_find_child<Key>(parent, child_max_key);
+
+  uint32_t original_num_keys = *internal_node_num_keys(parent);
+
+  uint32_t max_cells = table->write_buffering && is_node_root(parent)
+                       ? InternalNodeBufferLayout<Key>::MAX_CELLS
+                       : InternalNodeLayout<Key>::MAX_CELLS;
+  if (original_num_keys >= max_cells) {
+    // TABLE_MAX_PAGES is far below INTERNAL_NODE_MAX_CELLS, so the root can
+    // hold every leaf the pager can address.
+    std::cout << "Need to implement splitting internal node" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t right_child_page_num = *internal_node_right_child(parent);
+  std::byte *right_child = table->pager->get_page(right_child_page_num);
+  uint32_t right_child_count = *internal_node_child_count<Key>(
+      parent, original_num_keys);
+
+  *internal_node_num_keys(parent) = original_num_keys + 1;
+  *node_parent(child) = parent_page_num;
+  table_drop_internal_search(table, parent_page_num);
+
+  Key right_child_max_key = get_node_max_key<Key>(table->pager, right_child);
+  if (key_less(right_child_max_key, child_max_key)) {
+    // Replace right child.
+    *internal_node_child<Key>(parent, original_num_keys) =
+        right_child_page_num;
+    set_internal_node_key<Key>(parent, original_num_keys,
+                               right_child_max_key);
+    *internal_node_child_count<Key>(parent, original_num_keys) =
+        right_child_count;
+    *internal_node_right_child(parent) = child_page_num;
+    *internal_node_child_count<Key>(parent, original_num_keys + 1) =
+        get_node_row_count<Key>(child);
+  } else {
+    // Make room for the new cell.
+    for (uint32_t i = original_num_keys; i > index; i--) {
+      memcpy(internal_node_cell<Key>(parent, i),
+             internal_node_cell<Key>(parent, i - 1),
+             InternalNodeLayout<Key>::CELL_SIZE);
+    }
+    *internal_node_child<Key>(parent, index) = child_page_num;
+    set_internal_node_key<Key>(parent, index, child_max_key);
+    *internal_node_child_count<Key>(parent, index) =
+        get_node_row_count<Key>(child);
+  }
+}
+
+/*
+ * The root buffers writes when write buffering is on and it is internal.
+ * A leaf root has nothing to push rows down to.
+ * */
+bool table_buffer_active(Table *table, std::byte *root) {
+  return table->write_buffering && get_node_type(root) == NODE_INTERNAL;
+}
+
+/*
+ * Write latch the root and return its page number. .compact can move the
+ * root to another page while a writer waits for the old one, so the number
+ * is checked again once the latch is held.
+ * */
+uint32_t table_lock_root(Table *table) {
+  while (true) {
+    uint32_t root_page_num = table->root_page_num;
+    latch_write_lock(table->latches[root_page_num]);
+    if (root_page_num == table->root_page_num) {
+      return root_page_num;
+    }
+    latch_write_unlock(table->latches[root_page_num]);
+  }
+}
+
+/*
+ * Position of key in the write buffer of node, or where it would go.
+ * */
+template<typename Key = TableKey>
+uint32_t internal_node_buffer_find(std::byte *node,
+                                   KeyArg<Key> key,
+                                   bool &found) {
+  // Bounded for the same reason as internal_node_find_child.
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index =
+      std::min(*internal_node_buffer_count(node),
+               InternalNodeBufferLayout<Key>::MAX_MESSAGES);
+  found = false;
+
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    Key key_at_index = KeyTraits<Key>::load(
+        internal_node_buffer_message<Key>(node, index)
+            + LeafNodeLayout<Key>::KEY_OFFSET);
+    if (key_equal(key, key_at_index)) {
+      found = true;
+      return index;
+    }
+
+    if (key_less(key, key_at_index)) {
+      one_past_max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  return min_index;
+}
+
+/*
+ * Merge count sorted cells into the leaf page_num. Every existing cell is
+ * moved at most once, from the back, instead of once per inserted row.
+ * Cells that do not fit are inserted one by one, splitting as they go.
+ * */
+template<typename Key = TableKey>
+void leaf_node_insert_batch(Table *table,
+                            uint32_t page_num,
+                            std::byte *cells,
+                            uint32_t count) {
+  using Layout = LeafNodeLayout<Key>;
+  std::byte *node = table->pager->get_page(page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  if (get_node_type(node) != NODE_LEAF
+      || num_cells + count > Layout::MAX_CELLS) {
+    for (uint32_t i = 0; i < count; i++) {
+      std::byte *cell = cells + i * Layout::CELL_SIZE;
+      Key key = KeyTraits<Key>::load(cell + Layout::KEY_OFFSET);
+      Cursor cursor = table_find<Key>(table, key);
+      leaf_node_insert<Key>(&cursor, key, cell + Layout::VALUE_OFFSET);
+    }
+    return;
+  }
+
+  leaf_node_merge_unsorted<Key>(node);
+  leaf_node_merge_cells<Key>(node, num_cells, cells, count);
+  *leaf_node_num_cells(node) = num_cells + count;
+  leaf_node_zone_map_rebuild<Key>(node);
+  update_ancestor_row_counts<Key>(
+      table, page_num, KeyTraits<Key>::load(cells + Layout::KEY_OFFSET),
+      static_cast<int32_t>(count));
+}
+
+/*
+ * Push every buffered row down to its leaf. Rows bound for the same child
+ * go down together. Expects the root to be write latched by the caller.
+ * */
+template<typename Key = TableKey>
+void internal_node_flush_buffer(Table *table) {
+  using Layout = LeafNodeLayout<Key>;
+  std::byte *root = table->pager->get_page(table->root_page_num);
+  uint32_t count = *internal_node_buffer_count(root);
+
+  // Leaf splits add cells to the root, so work from a copy.
+  std::byte messages[INTERNAL_NODE_BUFFER_SIZE];
+  memcpy(messages, internal_node_buffer_message<Key>(root, 0),
+         count * Layout::CELL_SIZE);
+  *internal_node_buffer_count(root) = 0;
+
+  uint32_t message_num = 0;
+  while (message_num < count) {
+    std::byte *first = messages + message_num * Layout::CELL_SIZE;
+    Key key = KeyTraits<Key>::load(first + Layout::KEY_OFFSET);
+    uint32_t child_index = internal_node_find_child<Key>(root, key);
+    uint32_t child_page_num = *internal_node_child<Key>(root, child_index);
+
+    // The run ends at the first key past the child's separator.
+    uint32_t run = count - message_num;
+    if (child_index < *internal_node_num_keys(root)) {
+      Key separator = internal_node_key<Key>(root, child_index);
+      run = 1;
+      while (message_num + run < count
+          && !key_less(separator,
+                       KeyTraits<Key>::load(
+                           first + run * Layout::CELL_SIZE
+                               + Layout::KEY_OFFSET))) {
+        run++;
+      }
+    }
+
+    latch_write_lock(table->latches[child_page_num]);
+    leaf_node_insert_batch<Key>(table, child_page_num, first, run);
+    latch_write_unlock(table->latches[child_page_num]);
+    message_num += run;
+  }
+}
+
+template<typename Key = TableKey>
+void table_flush_buffer(Table *table) {
+  uint32_t root_page_num = table_lock_root(table);
+  std::byte *root = table->pager->get_page(root_page_num);
+  if (table_buffer_active(table, root)) {
+    internal_node_flush_buffer<Key>(table);
+  }
+  latch_write_unlock(table->latches[root_page_num]);
+}
+
+/*
+ * Park a row in the root's write buffer, flushing it first when full.
+ * Returns false if the key is already in the buffer or in a leaf. Expects
+ * the root to be write latched by the caller.
+ * */
+template<typename Key = TableKey>
+bool internal_node_buffer_insert(Table *table, KeyArg<Key> key, Row *value) {
+  using Layout = LeafNodeLayout<Key>;
+  std::byte *root = table->pager->get_page(table->root_page_num);
+
+  bool found = false;
+  internal_node_buffer_find<Key>(root, key, found);
+  if (found) {
+    return false;
+  }
+
+  Cursor cursor = table_find<Key>(table, key);
+  std::byte *leaf = table->pager->get_page(cursor.page_num);
+  found = cursor.cell_num < *leaf_node_num_cells(leaf)
+      && key_equal(leaf_node_key<Key>(leaf, cursor.cell_num), key);
+  if (found) {
+    return false;
+  }
+
+  uint32_t count = *internal_node_buffer_count(root);
+  if (count >= InternalNodeBufferLayout<Key>::MAX_MESSAGES) {
+    internal_node_flush_buffer<Key>(table);
+    count = 0;
+  }
+
+  uint32_t message_num = internal_node_buffer_find<Key>(root, key, found);
+  memmove(internal_node_buffer_message<Key>(root, message_num + 1),
+          internal_node_buffer_message<Key>(root, message_num),
+          (count - message_num) * Layout::CELL_SIZE);
+  std::byte *message = internal_node_buffer_message<Key>(root, message_num);
+  KeyTraits<Key>::store(message + Layout::KEY_OFFSET, key);
+  serialize_row(*value, message + Layout::VALUE_OFFSET, table->pager, 0);
+  *internal_node_buffer_count(root) = count + 1;
+
+  return true;
+}
+
+/*
+ * Lookups an internal node has to see, without its keys changing, before
+ * one of them builds the node's search index.
+ * */
+constexpr uint32_t INTERNAL_SEARCH_BUILD_AFTER = 64;
+
+/*
+ * internal_node_find_child for table_lookup, through the node's Eytzinger
+ * index once it has one. version is the reader's version of page_num. A
+ * reader that builds the index holds the write latch meanwhile and moves
+ * version past its own unlock, as nothing else changed the page. An index
+ * read without the latch may be from an older key count than the caller
+ * saw, so the caller bounds the child it gets back.
+ * */
+template<typename Key = TableKey>
+uint32_t internal_node_lookup_child(Table *table,
+                                    uint32_t page_num,
+                                    std::byte *node,
+                                    KeyArg<Key> key,
+                                    uint64_t &version) {
+  if constexpr (!std::is_same_v<Key, TableKey>) {
+    return internal_node_find_child<Key>(node, key);
+  } else {
+    InternalNodeSearch &search = table->internal_search[page_num];
+    if (!search.is_built.load(std::memory_order_acquire)) {
+      if (search.misses.fetch_add(1, std::memory_order_relaxed) + 1
+          < INTERNAL_SEARCH_BUILD_AFTER
+          || !latch_try_upgrade(table->latches[page_num], version)) {
+        return internal_node_find_child<Key>(node, key);
+      }
+
+      eytzinger_build(search.index, *internal_node_num_keys(node),
+                      [node](uint32_t rank) {
+                        return internal_node_key<Key>(node, rank);
+                      });
+      search.is_built.store(true, std::memory_order_release);
+      latch_write_unlock(table->latches[page_num]);
+      // One for the lock and one for the unlock.
+      version += 2;
+    }
+    return eytzinger_lower_bound(search.index, key);
+  }
+}
+
+/*
+ * Point lookup that can run on any number of threads alongside table_insert.
+ *
+ * Optimistic lock coupling: no latch is taken. The version of each page is
+ * read before the page and validated after it, and a child pointer is only
+ * followed once the parent it came from has been validated. The row is
+ * copied out of the leaf before the last validation, since the page may be
+ * changed as soon as that returns, and so is the rest of it from its
+ * overflow slot. Any mismatch restarts from the root.
+ * */
+template<typename Key = TableKey>
+bool table_lookup(Table *table, KeyArg<Key> key, Row &row) {
+  using Layout = LeafNodeLayout<Key>;
+  std::byte value[Layout::VALUE_SIZE];
+
+  for (uint32_t attempt = 0;; attempt++) {
+    if (attempt > 0) {
+      table->lookup_restarts.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint32_t page_num = table->root_page_num;
+    uint64_t version = latch_read_begin(table->latches[page_num]);
+    // .compact swaps in the new root before it unlatches the old one and
+    // gives its pages back, so by now the old root may hold anything.
+    if (page_num != table->root_page_num) {
+      continue;
+    }
+    std::byte *node = table->pager->get_page(page_num);
+    bool restart = false;
+
+    if (table_buffer_active(table, node)) {
+      bool found = false;
+      uint32_t message_num = internal_node_buffer_find<Key>(node, key, found);
+      if (found) {
+        memcpy(value,
+               internal_node_buffer_message<Key>(node, message_num)
+                   + Layout::VALUE_OFFSET,
+               Layout::VALUE_SIZE);
+        deserialize_row(value, row, table->pager);
+      }
+      if (!latch_read_validate(table->latches[page_num], version)) {
+        continue;
+      }
+      if (found) {
+        return true;
+      }
+    }
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+      // A writer may change the key count under us, and the search index
+      // may have been built from an older one. internal_node_child would
+      // fail on a child past the count, so that restarts instead.
+      uint32_t num_keys = *internal_node_num_keys(node);
+      uint32_t child_index =
+          internal_node_lookup_child<Key>(table, page_num, node, key, version);
+      if (num_keys > InternalNodeLayout<Key>::MAX_CELLS
+          || child_index > num_keys) {
+        restart = true;
+        break;
+      }
+      uint32_t child_page_num = child_index == num_keys
+                                ? *internal_node_right_child(node)
+                                : *internal_node_cell<Key>(node, child_index);
+      if (!latch_read_validate(table->latches[page_num], version)) {
+        restart = true;
+        break;
+      }
+
+      uint64_t child_version = latch_read_begin(table->latches[child_page_num]);
+      // The child may have been split away from under the parent meanwhile.
+      if (!latch_read_validate(table->latches[page_num], version)) {
+        restart = true;
+        break;
+      }
+
+      page_num = child_page_num;
+      version = child_version;
+      node = table->pager->get_page(page_num);
+    }
+
+    if (restart) {
+      continue;
+    }
+
+    bool found = false;
+    uint32_t cell_num = leaf_node_find_cell<Key>(node, key, found);
+    if (found) {
+      memcpy(value, leaf_node_value<Key>(node, cell_num), Layout::VALUE_SIZE);
+      // A row's overflow slot is written under the latch of the row's page,
+      // so it has to be read before that is validated too.
+      deserialize_row(value, row, table->pager);
+    }
+
+    if (!latch_read_validate(table->latches[page_num], version)) {
+      continue;
+    }
+
+    return found;
+  }
+}
+
+/*
+ * Insert that can run alongside table_lookup on other threads. Returns false
+ * if the key is already in the table.
+ *
+ * Every page on the root-to-leaf path is write latched, top down, before
+ * anything changes. That path is all an insert can modify: the leaf, the
+ * parents a split adds a child to, and the row count in every ancestor.
+ * Pages a split allocates are unreachable until their parent is unlatched.
+ *
+ * Only reads are concurrent with a write. The counts put the root on every
+ * path, so inserts, updates and .compact on different threads take turns
+ * on the root latch; lookups never wait on a writer longer than one page
+ * change and start over when a page they read was changed meanwhile.
+ * */
+template<typename Key = TableKey>
+bool table_insert(Table *table, KeyArg<Key> key, Row *value) {
+  if (table->write_buffering) {
+    uint32_t root_page_num = table_lock_root(table);
+    PageLatch &root_latch = table->latches[root_page_num];
+    std::byte *root = table->pager->get_page(root_page_num);
+    if (table_buffer_active(table, root)) {
+      bool is_inserted = internal_node_buffer_insert<Key>(table, key, value);
+      latch_write_unlock(root_latch);
+      return is_inserted;
+    }
+    // A leaf root has no room for a buffer, take the unbuffered path.
+    latch_write_unlock(root_latch);
+  }
+
+  uint32_t path[TABLE_MAX_PAGES];
+  uint32_t depth = 0;
+
+  uint32_t page_num = table_lock_root(table);
+  while (true) {
+    path[depth++] = page_num;
+
+    std::byte *node = table->pager->get_page(page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+      break;
+    }
+    uint32_t child_index = internal_node_find_child<Key>(node, key);
+    page_num = *internal_node_child<Key>(node, child_index);
+    latch_write_lock(table->latches[page_num]);
+  }
+
+  Cursor cursor = table_find<Key>(table, key);
+  std::byte *leaf = table->pager->get_page(cursor.page_num);
+  bool is_duplicate = cursor.cell_num < *leaf_node_num_cells(leaf)
+      && key_equal(leaf_node_key<Key>(leaf, cursor.cell_num), key);
+  if (!is_duplicate) {
+    std::byte row[LeafNodeLayout<Key>::VALUE_SIZE];
+    serialize_row(*value, row, table->pager, 0);
+    leaf_node_insert<Key>(&cursor, key, row);
+  }
+
+  while (depth > 0) {
+    latch_write_unlock(table->latches[path[--depth]]);
+  }
+
+  return !is_duplicate;
+}
+
+/*
+ * Overwrite the row stored under key. Rows are fixed size, so the new
+ * bytes go over the old ones in the one page that holds the row: nothing
+ * moves, splits or changes count. A long email reuses the row's overflow
+ * slot. Returns false if key is not in the table.
+ *
+ * Every insert latches the root, so holding it keeps splits from moving
+ * the row away between the find and the write.
+ * */
+template<typename Key = TableKey>
+bool table_update(Table *table, KeyArg<Key> key, Row *value) {
+  using Layout = LeafNodeLayout<Key>;
+  PageLatch &root_latch = table->latches[table_lock_root(table)];
+
+  std::byte *root = table->pager->get_page(table->root_page_num);
+  bool found = false;
+  if (table_buffer_active(table, root)) {
+    uint32_t message_num = internal_node_buffer_find<Key>(root, key, found);
+    if (found) {
+      std::byte *message_value =
+          internal_node_buffer_message<Key>(root, message_num)
+              + Layout::VALUE_OFFSET;
+      serialize_row(*value, message_value, table->pager,
+                    *row_overflow_slot(message_value));
+      latch_write_unlock(root_latch);
+      return true;
+    }
+  }
+
+  Cursor cursor = table_find<Key>(table, key);
+  std::byte *leaf = table->pager->get_page(cursor.page_num);
+  found = cursor.cell_num < *leaf_node_num_cells(leaf)
+      && key_equal(leaf_node_key<Key>(leaf, cursor.cell_num), key);
+
+  if (found) {
+    bool is_root = cursor.page_num == table->root_page_num;
+    if (!is_root) {
+      latch_write_lock(table->latches[cursor.page_num]);
+    }
+    auto *row = static_cast<std::byte *>(leaf_node_value<Key>(
+        leaf, cursor.cell_num));
+    serialize_row(*value, row, table->pager, *row_overflow_slot(row));
+    // The old values may still be the bounds; the map only has to cover.
+    leaf_node_zone_map_add(leaf, row, false);
+    if (!is_root) {
+      latch_write_unlock(table->latches[cursor.page_num]);
+    }
+  }
+
+  latch_write_unlock(root_latch);
+  return found;
+}
+
+/*
+ * Optimistic attempts .compact makes before it holds the root latch for
+ * the whole copy, which only a steady stream of writers makes necessary.
+ * */
+constexpr uint32_t COMPACT_OPTIMISTIC_ATTEMPTS = 3;
+
+/*
+ * Append every cell of the tree under root_page_num to cells, in key order.
+ *
+ * Nothing is latched, so a writer may be changing the pages being copied.
+ * Counts and page numbers are bounded so that a torn read copies garbage
+ * rather than running off a page; the caller finds out from the root's
+ * version and throws the copy away.
+ * */
+template<typename Key = TableKey>
+void table_copy_cells(Table *table,
+                      uint32_t root_page_num,
+                      std::vector<std::byte> &cells) {
+  using Layout = LeafNodeLayout<Key>;
+  cells.clear();
+
+  uint32_t page_num = root_page_num;
+  std::byte *node = table->pager->get_page(page_num);
+  for (uint32_t depth = 0;
+       get_node_type(node) == NODE_INTERNAL && depth < CURSOR_MAX_DEPTH;
+       depth++) {
+    page_num = *internal_node_child<Key>(node, 0);
+    if (page_num == 0 || page_num >= TABLE_MAX_PAGES) {
+      return;
+    }
+    node = table->pager->get_page(page_num);
+  }
+
+  // Sorting the append region needs a private copy of the leaf.
+  std::byte leaf[PAGE_SIZE];
+  for (uint32_t leaves = 0;
+       page_num != 0 && page_num < TABLE_MAX_PAGES && leaves < TABLE_MAX_PAGES;
+       leaves++) {
+    memcpy(leaf, table->pager->get_page(page_num), PAGE_SIZE);
+    uint32_t num_cells = std::min(*leaf_node_num_cells(leaf),
+                                  Layout::MAX_CELLS);
+    *leaf_node_num_cells(leaf) = num_cells;
+    *leaf_node_num_unsorted(leaf) = std::min({*leaf_node_num_unsorted(leaf),
+                                              LEAF_NODE_MAX_UNSORTED,
+                                              num_cells});
+    leaf_node_merge_unsorted<Key>(leaf);
+
+    auto *first = static_cast<std::byte *>(leaf_node_cell<Key>(leaf, 0));
+    cells.insert(cells.end(), first, first + num_cells * Layout::CELL_SIZE);
+    page_num = *leaf_node_next_leaf(leaf);
+  }
+}
+
+/*
+ * Append the page numbers of every node of the tree under page_num to
+ * pages. Expects the root to be write latched, so no writer changes the
+ * tree meanwhile.
+ * */
+template<typename Key = TableKey>
+void table_tree_pages(Table *table,
+                      uint32_t page_num,
+                      std::vector<uint32_t> &pages) {
+  pages.push_back(page_num);
+  std::byte *node = table->pager->get_page(page_num);
+  if (get_node_type(node) == NODE_LEAF) {
+    return;
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    table_tree_pages<Key>(table, *internal_node_child<Key>(node, i), pages);
+  }
+}
+
+/*
+ * Lay cells out as a new tree on pages taken from the pager, the root
+ * first and then the leaves in key order, and make it the table's tree.
+ * Each leaf gets fill_percent of the cells it can hold, the last one what
+ * is left. Expects the old root to be write latched by the caller. Returns
+ * false, changing nothing, if the pager is out of pages.
+ *
+ * The new pages are unreachable until root_page_num is swapped over, so
+ * lookups read the old tree meanwhile. Its pages are then latched once
+ * more, which makes any lookup still on them start over, and given back
+ * to the pager for the next compaction or split to reuse.
+ * */
+template<typename Key = TableKey>
+bool table_write_compacted(Table *table,
+                           const std::vector<std::byte> &cells,
+                           uint32_t fill_percent) {
+  using Layout = LeafNodeLayout<Key>;
+  Pager *pager = table->pager;
+  uint32_t num_rows = cells.size() / Layout::CELL_SIZE;
+
+  uint32_t max_children = table->write_buffering
+                          ? InternalNodeBufferLayout<Key>::MAX_CELLS + 1
+                          : InternalNodeLayout<Key>::MAX_CELLS + 1;
+  uint32_t rows_per_leaf =
+      std::max<uint32_t>(1, Layout::MAX_CELLS * fill_percent / 100);
+  // Internal nodes do not split, so the root has to take every leaf.
+  rows_per_leaf = std::max(rows_per_leaf,
+                           (num_rows + max_children - 1) / max_children);
+  uint32_t num_leaves =
+      std::max<uint32_t>(1, (num_rows + rows_per_leaf - 1) / rows_per_leaf);
+
+  // A single leaf is the root itself.
+  uint32_t num_new_pages = num_leaves > 1 ? num_leaves + 1 : 1;
+  if (num_new_pages > pager->get_num_unused_pages()) {
+    return false;
+  }
+
+  uint32_t old_root_page_num = table->root_page_num;
+  std::vector<uint32_t> old_pages;
+  table_tree_pages<Key>(table, old_root_page_num, old_pages);
+
+  uint32_t root_page_num = pager->get_unused_page_num();
+  std::byte *root = pager->get_page(root_page_num);
+  if (num_leaves > 1) {
+    initialize_internal_node(root);
+    *internal_node_num_keys(root) = num_leaves - 1;
+    if (table->write_buffering) {
+      *internal_node_buffer_count(root) = 0;
+    }
+  }
+
+  std::byte *previous_leaf = nullptr;
+  for (uint32_t leaf_num = 0; leaf_num < num_leaves; leaf_num++) {
+    uint32_t page_num = num_leaves > 1 ? pager->get_unused_page_num()
+                                       : root_page_num;
+    uint32_t first_row = leaf_num * rows_per_leaf;
+    uint32_t num_cells = std::min(rows_per_leaf, num_rows - first_row);
+
+    std::byte *leaf = pager->get_page(page_num);
+    initialize_leaf_node(leaf);
+    *node_parent(leaf) = root_page_num;
+    memcpy(leaf_node_cell<Key>(leaf, 0),
+           cells.data() + first_row * Layout::CELL_SIZE,
+           num_cells * Layout::CELL_SIZE);
+    *leaf_node_num_cells(leaf) = num_cells;
+    leaf_node_zone_map_rebuild<Key>(leaf);
+    // Pages come from the free list as well, so the next leaf's number is
+    // only known once it is taken.
+    if (previous_leaf != nullptr) {
+      *leaf_node_next_leaf(previous_leaf) = page_num;
+    }
+    previous_leaf = leaf;
+
+    if (num_leaves > 1) {
+      *internal_node_child<Key>(root, leaf_num) = page_num;
+      *internal_node_child_count<Key>(root, leaf_num) = num_cells;
+      if (leaf_num + 1 < num_leaves) {
+        set_internal_node_key<Key>(root, leaf_num,
+                                   leaf_node_key<Key>(leaf, num_cells - 1));
+      }
+    }
+    table->rightmost_leaf_page_num = page_num;
+  }
+  set_node_root(root, true);
+  table_drop_internal_search(table, root_page_num);
+
+  // Writers that get to the new root before the old pages are given back
+  // could be handed one of them while it is still latched below.
+  latch_write_lock(table->latches[root_page_num]);
+  *header_root_page_num(pager->get_page(HEADER_PAGE_NUM)) = root_page_num;
+  table->root_page_num = root_page_num;
+
+  // The caller holds the old root and unlatches it once this returns.
+  for (uint32_t page_num: old_pages) {
+    if (page_num != old_root_page_num) {
+      latch_write_lock(table->latches[page_num]);
+    }
+    table_drop_internal_search(table, page_num);
+    if (page_num != old_root_page_num) {
+      latch_write_unlock(table->latches[page_num]);
+    }
+    pager->free_page(page_num);
+  }
+  latch_write_unlock(table->latches[root_page_num]);
+  return true;
+}
+
+/*
+ * Rewrite the tree into freshly packed pages.
+ *
+ * The cells are copied out without latching anything, so lookups and
+ * writers carry on meanwhile. The copy is only used if the root's version
+ * shows no writer got in; every writer latches the root, so then nothing
+ * in the tree changed. After a few failed tries the root is held for the
+ * copy instead. Lookups are held up only while the new pages are written.
+ * */
+template<typename Key = TableKey>
+bool table_compact(Table *table, uint32_t fill_percent) {
+  table_flush_buffer<Key>(table);
+
+  std::vector<std::byte> cells;
+  for (uint32_t attempt = 0;; attempt++) {
+    uint32_t root_page_num = table->root_page_num;
+
+    if (attempt < COMPACT_OPTIMISTIC_ATTEMPTS) {
+      uint64_t version = latch_read_begin(table->latches[root_page_num]);
+      std::byte *root = table->pager->get_page(root_page_num);
+      if (table_buffer_active(table, root)
+          && *internal_node_buffer_count(root) > 0) {
+        continue;
+      }
+      table_copy_cells<Key>(table, root_page_num, cells);
+      if (!latch_try_upgrade(table->latches[root_page_num], version)) {
+        continue;
+      }
+      // Another .compact may have moved the root before version was read.
+      if (root_page_num != table->root_page_num) {
+        latch_write_unlock(table->latches[root_page_num]);
+        continue;
+      }
+    } else {
+      root_page_num = table_lock_root(table);
+      std::byte *root = table->pager->get_page(root_page_num);
+      if (table_buffer_active(table, root)) {
+        internal_node_flush_buffer<Key>(table);
+      }
+      table_copy_cells<Key>(table, root_page_num, cells);
+    }
+
+    bool is_compacted = table_write_compacted<Key>(table, cells, fill_percent);
+    latch_write_unlock(table->latches[root_page_num]);
+    return is_compacted;
+  }
 }
 
 #endif //RK_SQLLITE_CURSOR_H
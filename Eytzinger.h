@@ -0,0 +1,79 @@
+#ifndef RK_SQLLITE_EYTZINGER_H
+#define RK_SQLLITE_EYTZINGER_H
+
+#include <algorithm>
+#include <cstdint>
+#include "Key.h"
+
+constexpr uint32_t CACHE_LINE_SIZE = 64;
+
+/*
+ * Sorted keys stored in Eytzinger (breadth first) order: keys[1] is the
+ * middle key, the children of keys[k] are keys[2k] and keys[2k + 1].
+ *
+ * A binary search over a sorted array jumps across the array and its next
+ * step depends on a hard to predict branch. Here every step goes one level
+ * down the implicit tree, the next index is computed from the comparison
+ * instead of branched on, and the keys a few levels further down sit next
+ * to each other, so they can be prefetched a cache line at a time.
+ * */
+template<typename Key, uint32_t CAPACITY>
+struct EytzingerIndex {
+  uint32_t size;
+  // 1 based, keys[0] is unused so that the descendants of k start at a
+  // multiple of k.
+  alignas(CACHE_LINE_SIZE) Key keys[CAPACITY + 1];
+  // Position in sorted order of keys[k].
+  uint16_t ranks[CAPACITY + 1];
+};
+
+/*
+ * Place sorted keys from rank on into the subtree rooted at k, in order.
+ * load(rank) returns the key at that position. Returns the next rank.
+ * */
+template<typename Key, uint32_t CAPACITY, typename Load>
+uint32_t eytzinger_fill(EytzingerIndex<Key, CAPACITY> &index,
+                        uint32_t k,
+                        uint32_t rank,
+                        Load &load) {
+  if (k > index.size) {
+    return rank;
+  }
+  rank = eytzinger_fill(index, 2 * k, rank, load);
+  index.keys[k] = load(rank);
+  index.ranks[k] = rank;
+  return eytzinger_fill(index, 2 * k + 1, rank + 1, load);
+}
+
+template<typename Key, uint32_t CAPACITY, typename Load>
+void eytzinger_build(EytzingerIndex<Key, CAPACITY> &index,
+                     uint32_t size,
+                     Load load) {
+  index.size = std::min(size, CAPACITY);
+  eytzinger_fill(index, 1, 0, load);
+}
+
+/*
+ * Position in sorted order of the first key not less than key, or size if
+ * there is none: the same answer a lower bound on the sorted keys gives.
+ * */
+template<typename Key, uint32_t CAPACITY>
+uint32_t eytzinger_lower_bound(const EytzingerIndex<Key, CAPACITY> &index,
+                               const Key &key) {
+  // Descendants this many levels down fill exactly one cache line.
+  constexpr uint32_t PREFETCH_STRIDE =
+      std::max<uint32_t>(1, CACHE_LINE_SIZE / sizeof(Key));
+
+  uint32_t k = 1;
+  while (k <= index.size) {
+    __builtin_prefetch(index.keys + std::min(k * PREFETCH_STRIDE, CAPACITY));
+    k = 2 * k + key_less(index.keys[k], key);
+  }
+
+  // k fell off the tree. The answer is the last key it went left at, so
+  // drop the right turns taken since then and that left turn.
+  k >>= __builtin_ffs(~k);
+  return k == 0 ? index.size : index.ranks[k];
+}
+
+#endif //RK_SQLLITE_EYTZINGER_H
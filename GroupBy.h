@@ -0,0 +1,244 @@
+#ifndef RK_SQLLITE_GROUPBY_H
+#define RK_SQLLITE_GROUPBY_H
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "Arena.h"
+#include "Pager.h"
+
+/*
+ * Hash aggregation for GROUP BY and DISTINCT: a count per distinct string.
+ *
+ * Groups live in an open addressing table probed linearly, with the key
+ * bytes copied into an arena so a group costs one slot and its bytes, and
+ * dropping every group is a reset. When the slots and the arena outgrow
+ * the memory budget, every group is written out to one of
+ * GROUP_SPILL_PARTITIONS partitions on temp pages, picked by the top bits
+ * of its hash, and the table starts over empty. A key seen again after a
+ * spill gets a second partial count in the same partition, so at the end
+ * each partition is read back and aggregated on its own, a sixteenth of
+ * the groups at a time.
+ * */
+constexpr uint32_t GROUP_TABLE_MIN_SLOTS = 256;
+constexpr uint32_t GROUP_SPILL_PARTITIONS = 16;
+constexpr uint32_t GROUP_SPILL_PARTITION_SHIFT = 60;
+
+struct GroupEntry {
+  uint64_t hash; // 0 for an empty slot, keys never hash to it.
+  const char *key;
+  uint32_t key_length;
+  uint64_t count;
+};
+
+/*
+ * A spilled group on a temp page: key length | count | key bytes. Pages
+ * start with the number of bytes of records on them.
+ * */
+const uint32_t SPILL_USED_SIZE = sizeof(uint32_t);
+const uint32_t SPILL_RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+struct GroupSpillPartition {
+  std::vector<uint32_t> temp_page_nums;
+  std::byte page[PAGE_SIZE]; // records not yet written out.
+  uint32_t used;
+};
+
+struct GroupTable {
+  Pager *pager;
+  size_t memory_budget;
+  std::vector<GroupEntry> slots; // a power of two of them.
+  uint32_t num_groups;
+  Arena keys;
+  bool spilled;
+  std::unique_ptr<GroupSpillPartition[]> partitions;
+};
+
+uint64_t group_hash(std::string_view key) {
+  uint64_t hash = std::hash<std::string_view>{}(key);
+  return hash == 0 ? 1 : hash;
+}
+
+void group_table_clear(GroupTable &table) {
+  table.slots.assign(GROUP_TABLE_MIN_SLOTS, GroupEntry{});
+  table.num_groups = 0;
+  arena_reset(table.keys);
+}
+
+void group_table_init(GroupTable &table, Pager *pager, size_t memory_budget) {
+  table.pager = pager;
+  table.memory_budget = memory_budget;
+  table.spilled = false;
+  table.partitions.reset();
+  group_table_clear(table);
+}
+
+size_t group_table_memory(const GroupTable &table) {
+  return table.slots.size() * sizeof(GroupEntry) + table.keys.total;
+}
+
+/*
+ * The slot holding key, or the empty slot where it would go.
+ * */
+GroupEntry &group_table_find(GroupTable &table,
+                             uint64_t hash,
+                             std::string_view key) {
+  size_t mask = table.slots.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    GroupEntry &entry = table.slots[i];
+    if (entry.hash == 0
+        || (entry.hash == hash && entry.key_length == key.size()
+            && memcmp(entry.key, key.data(), key.size()) == 0)) {
+      return entry;
+    }
+  }
+}
+
+/*
+ * Double the slots once they are 70% full. Entries are moved by their
+ * stored hash; the keys stay where they are in the arena.
+ * */
+void group_table_grow(GroupTable &table) {
+  std::vector<GroupEntry> old_slots(table.slots.size() * 2, GroupEntry{});
+  old_slots.swap(table.slots);
+  size_t mask = table.slots.size() - 1;
+  for (const GroupEntry &entry: old_slots) {
+    if (entry.hash == 0) {
+      continue;
+    }
+    size_t i = entry.hash & mask;
+    while (table.slots[i].hash != 0) {
+      i = (i + 1) & mask;
+    }
+    table.slots[i] = entry;
+  }
+}
+
+void group_spill_record(GroupTable &table,
+                        const GroupEntry &entry) {
+  GroupSpillPartition &partition =
+      table.partitions[entry.hash >> GROUP_SPILL_PARTITION_SHIFT];
+  uint32_t record_size = SPILL_RECORD_HEADER_SIZE + entry.key_length;
+  if (partition.used + record_size > PAGE_SIZE) {
+    memcpy(partition.page, &partition.used, SPILL_USED_SIZE);
+    partition.temp_page_nums.push_back(
+        table.pager->write_temp_page(partition.page));
+    partition.used = SPILL_USED_SIZE;
+  }
+
+  std::byte *record = partition.page + partition.used;
+  memcpy(record, &entry.key_length, sizeof(uint32_t));
+  memcpy(record + sizeof(uint32_t), &entry.count, sizeof(uint64_t));
+  memcpy(record + SPILL_RECORD_HEADER_SIZE, entry.key, entry.key_length);
+  partition.used += record_size;
+}
+
+/*
+ * Move every group out to the spill partitions and empty the table.
+ * */
+void group_table_spill(GroupTable &table) {
+  if (!table.spilled) {
+    table.partitions = std::make_unique<GroupSpillPartition[]>(
+        GROUP_SPILL_PARTITIONS);
+    for (uint32_t i = 0; i < GROUP_SPILL_PARTITIONS; i++) {
+      table.partitions[i].used = SPILL_USED_SIZE;
+    }
+    table.spilled = true;
+  }
+
+  for (const GroupEntry &entry: table.slots) {
+    if (entry.hash != 0) {
+      group_spill_record(table, entry);
+    }
+  }
+  group_table_clear(table);
+}
+
+/*
+ * Add count to the group of key, making the group if it is new.
+ * may_spill is false while partitions are read back, which have to be
+ * aggregated in memory.
+ * */
+void group_table_add(GroupTable &table,
+                     std::string_view key,
+                     uint64_t count,
+                     bool may_spill = true) {
+  uint64_t hash = group_hash(key);
+  GroupEntry &entry = group_table_find(table, hash, key);
+  if (entry.hash != 0) {
+    entry.count += count;
+    return;
+  }
+
+  auto *bytes = static_cast<char *>(arena_allocate(table.keys, key.size(), 1));
+  memcpy(bytes, key.data(), key.size());
+  entry = {hash, bytes, static_cast<uint32_t>(key.size()), count};
+  table.num_groups++;
+
+  if (table.num_groups * 10 > table.slots.size() * 7) {
+    group_table_grow(table);
+  }
+  if (may_spill && group_table_memory(table) > table.memory_budget) {
+    group_table_spill(table);
+  }
+}
+
+template<typename Emit>
+void group_table_emit_slots(const GroupTable &table, Emit &emit) {
+  for (const GroupEntry &entry: table.slots) {
+    if (entry.hash != 0) {
+      emit(std::string_view(entry.key, entry.key_length), entry.count);
+    }
+  }
+}
+
+/*
+ * Call emit(key, count) once for every group, in no particular order, and
+ * drop the temp pages spilled on the way.
+ * */
+template<typename Emit>
+void group_table_finish(GroupTable &table, Emit emit) {
+  if (!table.spilled) {
+    group_table_emit_slots(table, emit);
+    return;
+  }
+
+  group_table_spill(table);
+  std::byte page[PAGE_SIZE];
+  for (uint32_t i = 0; i < GROUP_SPILL_PARTITIONS; i++) {
+    GroupSpillPartition &partition = table.partitions[i];
+    // The records still in memory count as the partition's last page.
+    memcpy(partition.page, &partition.used, SPILL_USED_SIZE);
+    partition.temp_page_nums.push_back(
+        table.pager->write_temp_page(partition.page));
+
+    for (uint32_t temp_page_num: partition.temp_page_nums) {
+      table.pager->read_temp_page(temp_page_num, page);
+      uint32_t used;
+      memcpy(&used, page, SPILL_USED_SIZE);
+      for (uint32_t offset = SPILL_USED_SIZE; offset < used;) {
+        uint32_t key_length;
+        uint64_t count;
+        memcpy(&key_length, page + offset, sizeof(uint32_t));
+        memcpy(&count, page + offset + sizeof(uint32_t), sizeof(uint64_t));
+        group_table_add(table,
+                        std::string_view(reinterpret_cast<const char *>(
+                                             page + offset
+                                                 + SPILL_RECORD_HEADER_SIZE),
+                                         key_length),
+                        count, false);
+        offset += SPILL_RECORD_HEADER_SIZE + key_length;
+      }
+    }
+    group_table_emit_slots(table, emit);
+    group_table_clear(table);
+  }
+
+  table.partitions.reset();
+  table.spilled = false;
+  table.pager->release_temp_pages();
+}
+
+#endif //RK_SQLLITE_GROUPBY_H
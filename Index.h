@@ -0,0 +1,693 @@
+#ifndef RK_SQLLITE_INDEX_H
+#define RK_SQLLITE_INDEX_H
+
+#include <algorithm>
+#include <cstring>
+#include "Node.h"
+#include "Pager.h"
+#include "Row.h"
+
+/*
+ * Secondary index on one of the text columns of Row.
+ *
+ * The index is a separate B+tree living in the same pager as the table. Its
+ * nodes share the common/leaf/internal headers with the table tree, only the
+ * cells differ: every leaf cell holds an entry made of the fixed width column
+ * value followed by the primary id. Entries are ordered by (value, id) which
+ * keeps them unique even when many rows share a username, and an equality
+ * lookup becomes a seek to (value, 0) followed by a walk over the leaves.
+ * */
+enum IndexColumn {
+  INDEX_COLUMN_USERNAME,
+  INDEX_COLUMN_EMAIL
+};
+
+struct Index {
+  Pager *pager;
+  uint32_t root_page_num; // 0 when the index has not been created.
+  IndexColumn column;
+};
+
+struct IndexCursor {
+  Index *index;
+  uint32_t page_num;
+  uint32_t cell_num;
+  bool end_of_index;
+};
+
+/*
+ * Largest entry we ever need to hold on the stack.
+ * */
+constexpr uint32_t INDEX_MAX_ENTRY_SIZE = EMAIL_SIZE + ID_SIZE;
+
+/*
+ * Index internal node layout.
+ *
+ * Separators only have to route a search, so they are not copies of leaf
+ * entries. A separator between two children is the shortest value that is
+ * >= everything on the left and < everything on the right (suffix
+ * truncation), and the bytes all separators of a node have in common are
+ * stored once after the header (prefix compression). Separators are
+ * variable length, so cells are reached through a slot array:
+ *
+ *   header | prefix length | prefix | slots (uint16 offsets) ... cells |
+ *
+ * Cells are packed at the end of the page and hold
+ *   child | id | suffix length | suffix.
+ * Every change to an internal node decodes it, edits the separators and
+ * encodes it again. Internal nodes only change when a child splits.
+ * */
+constexpr uint32_t INDEX_PREFIX_LENGTH_SIZE = sizeof(uint8_t);
+constexpr uint32_t INDEX_PREFIX_LENGTH_OFFSET = INTERNAL_NODE_HEADER_SIZE;
+constexpr uint32_t INDEX_PREFIX_OFFSET =
+    INDEX_PREFIX_LENGTH_OFFSET + INDEX_PREFIX_LENGTH_SIZE;
+constexpr uint32_t INDEX_SLOT_SIZE = sizeof(uint16_t);
+
+constexpr uint32_t INDEX_CELL_CHILD_OFFSET = 0;
+constexpr uint32_t INDEX_CELL_ID_OFFSET =
+    INDEX_CELL_CHILD_OFFSET + INTERNAL_NODE_CHILD_SIZE;
+constexpr uint32_t INDEX_CELL_SUFFIX_LENGTH_OFFSET =
+    INDEX_CELL_ID_OFFSET + ID_SIZE;
+constexpr uint32_t INDEX_CELL_SUFFIX_OFFSET =
+    INDEX_CELL_SUFFIX_LENGTH_OFFSET + sizeof(uint8_t);
+
+/*
+ * Decoded separator, used while rebuilding an internal node.
+ * */
+struct IndexSeparator {
+  uint32_t child;
+  TableKey id;
+  uint32_t length;
+  char value[EMAIL_SIZE];
+};
+
+constexpr uint32_t INDEX_MAX_SEPARATORS =
+    (PAGE_SIZE - INDEX_PREFIX_OFFSET) / (INDEX_SLOT_SIZE
+        + INDEX_CELL_SUFFIX_OFFSET) + 1;
+
+uint32_t index_key_size(const Index &index) {
+  return index.column == INDEX_COLUMN_USERNAME ? USERNAME_SIZE : EMAIL_SIZE;
+}
+
+/*
+ * Suffix and prefix lengths of separators are one byte, so a column can
+ * only be indexed while its values are no longer than that.
+ * */
+constexpr uint32_t INDEX_MAX_KEY_SIZE = UINT8_MAX + 1;
+
+bool index_column_fits(IndexColumn column) {
+  return (column == INDEX_COLUMN_USERNAME ? USERNAME_SIZE : EMAIL_SIZE)
+      <= INDEX_MAX_KEY_SIZE;
+}
+
+uint32_t index_entry_size(const Index &index) {
+  return index_key_size(index) + ID_SIZE;
+}
+
+uint32_t index_column_offset(const Index &index) {
+  return index.column == INDEX_COLUMN_USERNAME ? USERNAME_OFFSET
+                                               : EMAIL_OFFSET;
+}
+
+uint32_t index_leaf_max_cells(const Index &index) {
+  return (PAGE_SIZE - LEAF_NODE_HEADER_SIZE) / index_entry_size(index);
+}
+
+std::byte *index_leaf_entry(const Index &index,
+                            std::byte *node,
+                            uint32_t cell_num) {
+  return node + LEAF_NODE_HEADER_SIZE + cell_num * index_entry_size(index);
+}
+
+uint8_t *index_internal_prefix_length(std::byte *node) {
+  return reinterpret_cast<uint8_t *>(node + INDEX_PREFIX_LENGTH_OFFSET);
+}
+
+char *index_internal_prefix(std::byte *node) {
+  return reinterpret_cast<char *>(node + INDEX_PREFIX_OFFSET);
+}
+
+uint16_t *index_internal_slot(std::byte *node, uint32_t cell_num) {
+  return reinterpret_cast<uint16_t *>(node + INDEX_PREFIX_OFFSET
+      + *index_internal_prefix_length(node) + cell_num * INDEX_SLOT_SIZE);
+}
+
+std::byte *index_internal_cell(std::byte *node, uint32_t cell_num) {
+  return node + *index_internal_slot(node, cell_num);
+}
+
+uint32_t *index_internal_child(std::byte *node, uint32_t child_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  if (child_num > num_keys) {
+    std::cout << "Tried to access index child_num " << child_num << " > "
+              << num_keys << std::endl;
+    exit(EXIT_FAILURE);
+  } else if (child_num == num_keys) {
+    return internal_node_right_child(node);
+  } else {
+    return reinterpret_cast<uint32_t *>(index_internal_cell(node, child_num)
+        + INDEX_CELL_CHILD_OFFSET);
+  }
+}
+
+TableKey index_internal_id(std::byte *node, uint32_t key_num) {
+  TableKey id;
+  memcpy(&id, index_internal_cell(node, key_num) + INDEX_CELL_ID_OFFSET,
+         ID_SIZE);
+  return id;
+}
+
+uint8_t index_internal_suffix_length(std::byte *node, uint32_t key_num) {
+  return *reinterpret_cast<uint8_t *>(index_internal_cell(node, key_num)
+      + INDEX_CELL_SUFFIX_LENGTH_OFFSET);
+}
+
+char *index_internal_suffix(std::byte *node, uint32_t key_num) {
+  return reinterpret_cast<char *>(index_internal_cell(node, key_num)
+      + INDEX_CELL_SUFFIX_OFFSET);
+}
+
+/*
+ * Build an entry from a column value. strncpy zero pads, so two entries for
+ * the same value are byte for byte identical.
+ * */
+void index_make_entry(const Index &index,
+                      const char *value,
+                      TableKey id,
+                      std::byte *entry) {
+  uint32_t key_size = index_key_size(index);
+  strncpy(reinterpret_cast<char *>(entry), value, key_size);
+  memcpy(entry + key_size, &id, ID_SIZE);
+}
+
+TableKey index_entry_id(const Index &index, const std::byte *entry) {
+  TableKey id;
+  memcpy(&id, entry + index_key_size(index), ID_SIZE);
+  return id;
+}
+
+const char *index_entry_value(const std::byte *entry) {
+  return reinterpret_cast<const char *>(entry);
+}
+
+uint32_t index_entry_length(const Index &index, const std::byte *entry) {
+  return strnlen(index_entry_value(entry), index_key_size(index));
+}
+
+/*
+ * Byte wise comparison where a proper prefix sorts first, which is what
+ * strncmp gives for the zero padded column values.
+ * */
+int index_compare_values(const char *a,
+                         uint32_t a_length,
+                         const char *b,
+                         uint32_t b_length) {
+  int result = memcmp(a, b, std::min(a_length, b_length));
+  if (result != 0) {
+    return result;
+  }
+  return KeyTraits<uint32_t>::compare(a_length, b_length);
+}
+
+int index_entry_compare(const Index &index,
+                        const std::byte *a,
+                        const std::byte *b) {
+  int result = strncmp(index_entry_value(a),
+                       index_entry_value(b),
+                       index_key_size(index));
+  if (result != 0) {
+    return result;
+  }
+
+  return KeyTraits<TableKey>::compare(index_entry_id(index, a),
+                                      index_entry_id(index, b));
+}
+
+/*
+ * Compare separator key_num of an internal node with an entry. The
+ * separator value is the node prefix followed by the cell suffix.
+ * */
+int index_internal_compare(const Index &index,
+                           std::byte *node,
+                           uint32_t key_num,
+                           const std::byte *entry) {
+  const char *value = index_entry_value(entry);
+  uint32_t length = index_entry_length(index, entry);
+  uint32_t prefix_length = *index_internal_prefix_length(node);
+
+  int result = memcmp(index_internal_prefix(node), value,
+                      std::min(prefix_length, length));
+  if (result != 0) {
+    return result;
+  }
+  if (length < prefix_length) {
+    return 1;
+  }
+
+  result = index_compare_values(index_internal_suffix(node, key_num),
+                                index_internal_suffix_length(node, key_num),
+                                value + prefix_length,
+                                length - prefix_length);
+  if (result != 0) {
+    return result;
+  }
+
+  return KeyTraits<TableKey>::compare(index_internal_id(node, key_num),
+                                      index_entry_id(index, entry));
+}
+
+/*
+ * Index of the first separator >= entry, i.e. the child whose range holds
+ * entry. Same contract as internal_node_find_child.
+ * */
+uint32_t index_internal_find_child(const Index &index,
+                                   std::byte *node,
+                                   const std::byte *entry) {
+  uint32_t min_index = 0;
+  uint32_t max_index = *internal_node_num_keys(node);
+
+  while (min_index != max_index) {
+    uint32_t i = (min_index + max_index) / 2;
+    if (index_internal_compare(index, node, i, entry) >= 0) {
+      max_index = i;
+    } else {
+      min_index = i + 1;
+    }
+  }
+
+  return min_index;
+}
+
+/*
+ * Expand every separator of node into separators. Returns the count.
+ * */
+uint32_t index_internal_decode(std::byte *node, IndexSeparator *separators) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t prefix_length = *index_internal_prefix_length(node);
+
+  for (uint32_t i = 0; i < num_keys; i++) {
+    IndexSeparator &separator = separators[i];
+    uint32_t suffix_length = index_internal_suffix_length(node, i);
+    separator.child = *index_internal_child(node, i);
+    separator.id = index_internal_id(node, i);
+    separator.length = prefix_length + suffix_length;
+    memcpy(separator.value, index_internal_prefix(node), prefix_length);
+    memcpy(separator.value + prefix_length,
+           index_internal_suffix(node, i),
+           suffix_length);
+  }
+
+  return num_keys;
+}
+
+/*
+ * Separators are sorted, so the prefix shared by all of them is the one
+ * shared by the first and the last.
+ * */
+uint32_t index_common_prefix_length(const IndexSeparator *separators,
+                                    uint32_t count) {
+  if (count == 0) {
+    return 0;
+  }
+
+  const IndexSeparator &first = separators[0];
+  const IndexSeparator &last = separators[count - 1];
+  uint32_t length = std::min(first.length, last.length);
+  uint32_t i = 0;
+  while (i < length && first.value[i] == last.value[i]) {
+    i++;
+  }
+  return i;
+}
+
+uint32_t index_internal_encoded_size(const IndexSeparator *separators,
+                                     uint32_t count) {
+  uint32_t prefix_length = index_common_prefix_length(separators, count);
+  uint32_t size = INDEX_PREFIX_OFFSET + prefix_length;
+  for (uint32_t i = 0; i < count; i++) {
+    size += INDEX_SLOT_SIZE + INDEX_CELL_SUFFIX_OFFSET
+        + separators[i].length - prefix_length;
+  }
+  return size;
+}
+
+/*
+ * Write separators and right_child into node. Leaves node untouched and
+ * returns false when they do not fit in a page.
+ * */
+bool index_internal_encode(std::byte *node,
+                           const IndexSeparator *separators,
+                           uint32_t count,
+                           uint32_t right_child) {
+  if (index_internal_encoded_size(separators, count) > PAGE_SIZE) {
+    return false;
+  }
+
+  uint32_t prefix_length = index_common_prefix_length(separators, count);
+  *internal_node_num_keys(node) = count;
+  *internal_node_right_child(node) = right_child;
+  *index_internal_prefix_length(node) = prefix_length;
+  if (count > 0) {
+    memcpy(index_internal_prefix(node), separators[0].value, prefix_length);
+  }
+
+  uint32_t cell_offset = PAGE_SIZE;
+  for (uint32_t i = 0; i < count; i++) {
+    const IndexSeparator &separator = separators[i];
+    uint8_t suffix_length = separator.length - prefix_length;
+    cell_offset -= INDEX_CELL_SUFFIX_OFFSET + suffix_length;
+    *index_internal_slot(node, i) = cell_offset;
+
+    std::byte *cell = node + cell_offset;
+    memcpy(cell + INDEX_CELL_CHILD_OFFSET, &separator.child,
+           INTERNAL_NODE_CHILD_SIZE);
+    memcpy(cell + INDEX_CELL_ID_OFFSET, &separator.id, ID_SIZE);
+    memcpy(cell + INDEX_CELL_SUFFIX_LENGTH_OFFSET, &suffix_length,
+           sizeof(uint8_t));
+    memcpy(cell + INDEX_CELL_SUFFIX_OFFSET,
+           separator.value + prefix_length,
+           suffix_length);
+  }
+
+  return true;
+}
+
+/*
+ * Shortest separator s with left <= s < right, where left is the last entry
+ * of a leaf and right the first entry of its right sibling. The candidate is
+ * right's value cut one byte past the common prefix; when that does not
+ * separate the two (equal values, or right is that short) the full left entry
+ * is used.
+ * */
+void index_shortest_separator(const Index &index,
+                              const std::byte *left,
+                              const std::byte *right,
+                              IndexSeparator &separator) {
+  uint32_t left_length = index_entry_length(index, left);
+  uint32_t right_length = index_entry_length(index, right);
+  const char *left_value = index_entry_value(left);
+  const char *right_value = index_entry_value(right);
+
+  uint32_t common = 0;
+  while (common < left_length && common < right_length
+      && left_value[common] == right_value[common]) {
+    common++;
+  }
+
+  if (common < right_length) {
+    separator.length = common + 1;
+    separator.id = 0;
+    memcpy(separator.value, right_value, separator.length);
+
+    int below_right = index_compare_values(separator.value, separator.length,
+                                           right_value, right_length);
+    if (below_right < 0 || (below_right == 0
+        && index_entry_id(index, right) > 0)) {
+      return;
+    }
+  }
+
+  separator.length = left_length;
+  separator.id = index_entry_id(index, left);
+  memcpy(separator.value, left_value, left_length);
+}
+
+IndexCursor index_find(Index &index, const std::byte *entry) {
+  uint32_t page_num = index.root_page_num;
+  std::byte *node = index.pager->get_page(page_num);
+
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t child_index = index_internal_find_child(index, node, entry);
+    page_num = *index_internal_child(node, child_index);
+    node = index.pager->get_page(page_num);
+  }
+
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index = *leaf_node_num_cells(node);
+  while (one_past_max_index != min_index) {
+    uint32_t i = (min_index + one_past_max_index) / 2;
+    int result =
+        index_entry_compare(index, entry, index_leaf_entry(index, node, i));
+    if (result == 0) {
+      min_index = i;
+      break;
+    }
+    if (result < 0) {
+      one_past_max_index = i;
+    } else {
+      min_index = i + 1;
+    }
+  }
+
+  return IndexCursor{&index, page_num, min_index, false};
+}
+
+/*
+ * Step to the next leaf when the cursor is past the last cell of its leaf.
+ * */
+void index_cursor_skip_exhausted_leaf(IndexCursor *cursor) {
+  std::byte *node = cursor->index->pager->get_page(cursor->page_num);
+  while (cursor->cell_num >= *leaf_node_num_cells(node)) {
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      cursor->end_of_index = true;
+      return;
+    }
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+    node = cursor->index->pager->get_page(next_page_num);
+  }
+}
+
+void index_cursor_advance(IndexCursor *cursor) {
+  cursor->cell_num += 1;
+  index_cursor_skip_exhausted_leaf(cursor);
+}
+
+std::byte *index_cursor_entry(IndexCursor *cursor) {
+  std::byte *node = cursor->index->pager->get_page(cursor->page_num);
+  return index_leaf_entry(*cursor->index, node, cursor->cell_num);
+}
+
+/*
+ * Handle splitting the root: the old root moves to a new page and becomes
+ * the left child, the root page gets a single separator.
+ * */
+void index_create_new_root(Index &index,
+                           const IndexSeparator &separator,
+                           uint32_t right_child_page_num) {
+  std::byte *root = index.pager->get_page(index.root_page_num);
+  std::byte *right_child = index.pager->get_page(right_child_page_num);
+  uint32_t left_child_page_num = index.pager->get_unused_page_num();
+  std::byte *left_child = index.pager->get_page(left_child_page_num);
+
+  memcpy(left_child, root, PAGE_SIZE);
+  set_node_root(left_child, false);
+
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+      std::byte *child =
+          index.pager->get_page(*index_internal_child(left_child, i));
+      *node_parent(child) = left_child_page_num;
+    }
+  }
+
+  IndexSeparator root_separator = separator;
+  root_separator.child = left_child_page_num;
+  initialize_internal_node(root);
+  set_node_root(root, true);
+  index_internal_encode(root, &root_separator, 1, right_child_page_num);
+  *node_parent(left_child) = index.root_page_num;
+  *node_parent(right_child) = index.root_page_num;
+}
+
+/*
+ * left_node (at left_page_num) was split and right_page_num holds its upper
+ * half; separator divides the two. The separator left_node had in its parent
+ * still bounds the upper half, so it is handed to right_page_num and the new
+ * separator is added for left_node. A parent that overflows is split the
+ * same way, pushing its middle separator further up.
+ * */
+void index_insert_into_parent(Index &index,
+                              std::byte *left_node,
+                              uint32_t left_page_num,
+                              const IndexSeparator &separator,
+                              uint32_t right_page_num) {
+  if (is_node_root(left_node)) {
+    index_create_new_root(index, separator, right_page_num);
+    return;
+  }
+
+  uint32_t parent_page_num = *node_parent(left_node);
+  std::byte *parent = index.pager->get_page(parent_page_num);
+  *node_parent(index.pager->get_page(right_page_num)) = parent_page_num;
+
+  auto *separators = new IndexSeparator[INDEX_MAX_SEPARATORS + 1];
+  uint32_t count = index_internal_decode(parent, separators);
+  uint32_t right_child = *internal_node_right_child(parent);
+
+  uint32_t position = count;
+  for (uint32_t i = 0; i < count; i++) {
+    if (separators[i].child == left_page_num) {
+      position = i;
+      break;
+    }
+  }
+
+  memmove(separators + position + 1, separators + position,
+          (count - position) * sizeof(IndexSeparator));
+  separators[position] = separator;
+  separators[position].child = left_page_num;
+  count++;
+  if (position + 1 < count) {
+    separators[position + 1].child = right_page_num;
+  } else {
+    right_child = right_page_num;
+  }
+
+  if (index_internal_encode(parent, separators, count, right_child)) {
+    delete[] separators;
+    return;
+  }
+
+  // Split the parent. The middle separator moves up, its child becomes the
+  // right child of the lower half.
+  uint32_t middle = count / 2;
+  uint32_t new_page_num = index.pager->get_unused_page_num();
+  std::byte *new_node = index.pager->get_page(new_page_num);
+  initialize_internal_node(new_node);
+  *node_parent(new_node) = *node_parent(parent);
+
+  index_internal_encode(parent, separators, middle, separators[middle].child);
+  index_internal_encode(new_node, separators + middle + 1,
+                        count - middle - 1, right_child);
+
+  for (uint32_t i = 0; i <= *internal_node_num_keys(new_node); i++) {
+    std::byte *moved = index.pager->get_page(*index_internal_child(new_node,
+                                                                   i));
+    *node_parent(moved) = new_page_num;
+  }
+
+  IndexSeparator pushed_up = separators[middle];
+  delete[] separators;
+
+  index_insert_into_parent(index, parent, parent_page_num, pushed_up,
+                           new_page_num);
+}
+
+void index_leaf_split_and_insert(IndexCursor *cursor, const std::byte *entry) {
+  Index &index = *cursor->index;
+  uint32_t entry_size = index_entry_size(index);
+  uint32_t max_cells = index_leaf_max_cells(index);
+  uint32_t right_split_count = (max_cells + 1) / 2;
+  uint32_t left_split_count = (max_cells + 1) - right_split_count;
+
+  std::byte *old_node = index.pager->get_page(cursor->page_num);
+  uint32_t new_page_num = index.pager->get_unused_page_num();
+  std::byte *new_node = index.pager->get_page(new_page_num);
+  initialize_leaf_node(new_node);
+  *node_parent(new_node) = *node_parent(old_node);
+  *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+  *leaf_node_next_leaf(old_node) = new_page_num;
+
+  for (int32_t i = max_cells; i >= 0; i--) {
+    std::byte *destination_node;
+    uint32_t index_within_node;
+    if (static_cast<uint32_t>(i) >= left_split_count) {
+      destination_node = new_node;
+      index_within_node = i - left_split_count;
+    } else {
+      destination_node = old_node;
+      index_within_node = i;
+    }
+    std::byte *destination = index_leaf_entry(index,
+                                              destination_node,
+                                              index_within_node);
+
+    if (static_cast<uint32_t>(i) == cursor->cell_num) {
+      memcpy(destination, entry, entry_size);
+    } else if (static_cast<uint32_t>(i) > cursor->cell_num) {
+      memcpy(destination, index_leaf_entry(index, old_node, i - 1),
+             entry_size);
+    } else {
+      memcpy(destination, index_leaf_entry(index, old_node, i), entry_size);
+    }
+  }
+
+  *leaf_node_num_cells(old_node) = left_split_count;
+  *leaf_node_num_cells(new_node) = right_split_count;
+
+  IndexSeparator separator{};
+  index_shortest_separator(index,
+                           index_leaf_entry(index, old_node,
+                                            left_split_count - 1),
+                           index_leaf_entry(index, new_node, 0),
+                           separator);
+  index_insert_into_parent(index, old_node, cursor->page_num, separator,
+                           new_page_num);
+}
+
+void index_leaf_insert(IndexCursor *cursor, const std::byte *entry) {
+  Index &index = *cursor->index;
+  std::byte *node = index.pager->get_page(cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  if (num_cells >= index_leaf_max_cells(index)) {
+    index_leaf_split_and_insert(cursor, entry);
+    return;
+  }
+
+  // Cells are contiguous, so one memmove opens the gap.
+  std::byte *destination = index_leaf_entry(index, node, cursor->cell_num);
+  memmove(destination + index_entry_size(index),
+          destination,
+          (num_cells - cursor->cell_num) * index_entry_size(index));
+  memcpy(destination, entry, index_entry_size(index));
+  *leaf_node_num_cells(node) += 1;
+}
+
+void index_insert(Index &index, const char *value, TableKey id) {
+  std::byte entry[INDEX_MAX_ENTRY_SIZE];
+  index_make_entry(index, value, id, entry);
+
+  IndexCursor cursor = index_find(index, entry);
+  index_leaf_insert(&cursor, entry);
+}
+
+/*
+ * Remove the entry for (value, id), if there is one. Leaves are left in
+ * place when they empty out: separators still bound them from above and
+ * cursors step over empty leaves.
+ * */
+void index_delete(Index &index, const char *value, TableKey id) {
+  std::byte entry[INDEX_MAX_ENTRY_SIZE];
+  index_make_entry(index, value, id, entry);
+
+  IndexCursor cursor = index_find(index, entry);
+  std::byte *node = index.pager->get_page(cursor.page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  std::byte *target = index_leaf_entry(index, node, cursor.cell_num);
+
+  if (cursor.cell_num < num_cells
+      && index_entry_compare(index, entry, target) == 0) {
+    memmove(target,
+            target + index_entry_size(index),
+            (num_cells - cursor.cell_num - 1) * index_entry_size(index));
+    *leaf_node_num_cells(node) -= 1;
+  }
+}
+
+/*
+ * Allocate a root leaf for the index. The caller fills it with index_insert.
+ * */
+void index_create(Index &index, Pager *pager, IndexColumn column) {
+  index.pager = pager;
+  index.column = column;
+  index.root_page_num = pager->get_unused_page_num();
+
+  std::byte *root = pager->get_page(index.root_page_num);
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+}
+
+#endif //RK_SQLLITE_INDEX_H
@@ -0,0 +1,162 @@
+#ifndef RK_SQLLITE_KEY_H
+#define RK_SQLLITE_KEY_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+/*
+ * Key types for the B+tree.
+ *
+ * The node and cursor functions are templates on the key type. A type K can
+ * be used as a key when KeyTraits<K> provides:
+ *   SIZE          bytes the key takes inside a cell,
+ *   load/store    copies from/to (unaligned) cell bytes,
+ *   compare       three way comparison,
+ *   min           the smallest key, where a full scan seeks to.
+ * Unsigned integers are the fast path: load/store are a single memcpy and
+ * key_less/key_equal compare them directly instead of going through compare.
+ * */
+template<typename K, typename Enable = void>
+struct KeyTraits;
+
+template<typename K>
+struct KeyTraits<K, std::enable_if_t<std::is_integral_v<K>
+                                         && std::is_unsigned_v<K>>> {
+  static constexpr uint32_t SIZE = sizeof(K);
+
+  static K load(const void *source) {
+    K key;
+    memcpy(&key, source, SIZE);
+    return key;
+  }
+
+  static void store(void *destination, const K &key) {
+    memcpy(destination, &key, SIZE);
+  }
+
+  static int compare(const K &a, const K &b) {
+    return a < b ? -1 : (a > b ? 1 : 0);
+  }
+
+  static K min() {
+    return 0;
+  }
+};
+
+/*
+ * Fixed width byte string, compared byte wise. Shorter values are zero
+ * padded, so "ab" sorts before "abc".
+ * */
+template<uint32_t N>
+struct FixedKey {
+  char bytes[N];
+};
+
+template<uint32_t N>
+struct KeyTraits<FixedKey<N>> {
+  static constexpr uint32_t SIZE = N;
+
+  static FixedKey<N> load(const void *source) {
+    FixedKey<N> key;
+    memcpy(key.bytes, source, SIZE);
+    return key;
+  }
+
+  static void store(void *destination, const FixedKey<N> &key) {
+    memcpy(destination, key.bytes, SIZE);
+  }
+
+  static int compare(const FixedKey<N> &a, const FixedKey<N> &b) {
+    return memcmp(a.bytes, b.bytes, SIZE);
+  }
+
+  static FixedKey<N> min() {
+    return FixedKey<N>{};
+  }
+};
+
+/*
+ * Two keys ordered lexicographically, e.g. (tenant, id).
+ * */
+template<typename First, typename Second>
+struct CompositeKey {
+  First first;
+  Second second;
+};
+
+template<typename First, typename Second>
+struct KeyTraits<CompositeKey<First, Second>> {
+  static constexpr uint32_t SIZE =
+      KeyTraits<First>::SIZE + KeyTraits<Second>::SIZE;
+
+  static CompositeKey<First, Second> load(const void *source) {
+    auto *bytes = static_cast<const char *>(source);
+    return {KeyTraits<First>::load(bytes),
+            KeyTraits<Second>::load(bytes + KeyTraits<First>::SIZE)};
+  }
+
+  static void store(void *destination, const CompositeKey<First, Second> &key) {
+    auto *bytes = static_cast<char *>(destination);
+    KeyTraits<First>::store(bytes, key.first);
+    KeyTraits<Second>::store(bytes + KeyTraits<First>::SIZE, key.second);
+  }
+
+  static int compare(const CompositeKey<First, Second> &a,
+                     const CompositeKey<First, Second> &b) {
+    int result = KeyTraits<First>::compare(a.first, b.first);
+    if (result != 0) {
+      return result;
+    }
+    return KeyTraits<Second>::compare(a.second, b.second);
+  }
+
+  static CompositeKey<First, Second> min() {
+    return {KeyTraits<First>::min(), KeyTraits<Second>::min()};
+  }
+};
+
+template<typename K>
+bool key_less(const K &a, const K &b) {
+  if constexpr (std::is_integral_v<K>) {
+    return a < b;
+  } else {
+    return KeyTraits<K>::compare(a, b) < 0;
+  }
+}
+
+template<typename K>
+bool key_equal(const K &a, const K &b) {
+  if constexpr (std::is_integral_v<K>) {
+    return a == b;
+  } else {
+    return KeyTraits<K>::compare(a, b) == 0;
+  }
+}
+
+template<uint32_t N>
+std::ostream &operator<<(std::ostream &out, const FixedKey<N> &key) {
+  return out.write(key.bytes, strnlen(key.bytes, N));
+}
+
+template<typename First, typename Second>
+std::ostream &operator<<(std::ostream &out,
+                         const CompositeKey<First, Second> &key) {
+  return out << "(" << key.first << ", " << key.second << ")";
+}
+
+/*
+ * Wrapping a parameter in KeyArg keeps it out of template argument
+ * deduction, so table_find(table, 0) uses the default key type rather than
+ * trying to instantiate the tree for int.
+ * */
+template<typename K>
+struct NonDeduced {
+  using type = K;
+};
+
+template<typename K>
+using KeyArg = typename NonDeduced<K>::type;
+
+#endif //RK_SQLLITE_KEY_H
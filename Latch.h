@@ -0,0 +1,77 @@
+#ifndef RK_SQLLITE_LATCH_H
+#define RK_SQLLITE_LATCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+/*
+ * Per-page version latch for optimistic lock coupling.
+ *
+ * The word holds a version counter with the lowest bit set while a writer
+ * holds the page. Readers do not write to the latch: they remember the
+ * version before reading a page and check it is unchanged afterwards. A
+ * writer adds one when it locks and one when it unlocks, so any reader that
+ * overlapped with it sees a different version and restarts.
+ * */
+struct PageLatch {
+  std::atomic<uint64_t> version{0};
+};
+
+constexpr uint64_t LATCH_LOCKED_BIT = 1;
+
+/*
+ * Wait until no writer holds the page and return the version to validate
+ * the read against.
+ * */
+uint64_t latch_read_begin(PageLatch &latch) {
+  uint64_t version = latch.version.load(std::memory_order_acquire);
+  while (version & LATCH_LOCKED_BIT) {
+    std::this_thread::yield();
+    version = latch.version.load(std::memory_order_acquire);
+  }
+  return version;
+}
+
+/*
+ * True when nothing was written to the page since latch_read_begin
+ * returned version, i.e. what was read from it is consistent.
+ * */
+bool latch_read_validate(PageLatch &latch, uint64_t version) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return latch.version.load(std::memory_order_relaxed) == version;
+}
+
+void latch_write_lock(PageLatch &latch) {
+  uint64_t version = latch.version.load(std::memory_order_relaxed);
+  while ((version & LATCH_LOCKED_BIT)
+      || !latch.version.compare_exchange_weak(version,
+                                              version + 1,
+                                              std::memory_order_acquire)) {
+    std::this_thread::yield();
+    version = latch.version.load(std::memory_order_relaxed);
+  }
+  // Keep the page writes that follow from moving above the version change.
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+/*
+ * Write lock the page only if it is still at version, i.e. nobody wrote to
+ * it since latch_read_begin returned version. Lets a reader that built
+ * something from the page publish it without rereading.
+ * */
+bool latch_try_upgrade(PageLatch &latch, uint64_t version) {
+  if (!latch.version.compare_exchange_strong(version,
+                                             version + 1,
+                                             std::memory_order_acquire)) {
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
+void latch_write_unlock(PageLatch &latch) {
+  latch.version.fetch_add(1, std::memory_order_release);
+}
+
+#endif //RK_SQLLITE_LATCH_H
@@ -13,6 +13,7 @@ enum MetaCommandResult {
 enum PrepareResult {
   PREPARE_SUCCESS,
   PREPARE_SYNTAX_ERROR,
+  PREPARE_STRING_TOO_LONG,
   PREPARE_UNRECOGNIZED_STATEMENT
 };
 
@@ -4,8 +4,10 @@
 
 #ifndef RK_SQLLITE_NODE_H
 #define RK_SQLLITE_NODE_H
+#include <algorithm>
 #include <iostream>
 #include <cstdint>
+#include "Key.h"
 #include "Row.h"
 
 enum NodeType {
@@ -30,27 +32,75 @@ constexpr uint8_t COMMON_NODE_HEADER_SIZE =
  * */
 constexpr uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 constexpr uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-constexpr uint32_t
-    LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
+constexpr uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+constexpr uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
+    LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+constexpr uint32_t LEAF_NODE_NUM_UNSORTED_SIZE = sizeof(uint32_t);
+constexpr uint32_t LEAF_NODE_NUM_UNSORTED_OFFSET =
+    LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+constexpr uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE
+    + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE
+    + LEAF_NODE_NUM_UNSORTED_SIZE;
+
+/*
+ * The last num_unsorted cells of a table leaf are an append region: rows
+ * inserted there in arrival order instead of shifting the cells after
+ * them. The region is merged into the sorted cells when it fills up, before
+ * a split and before an ordered read of the leaf.
+ * */
+constexpr uint32_t LEAF_NODE_MAX_UNSORTED = 4;
+
+/*
+ * Leaf zone map.
+ *
+ * The end of a table leaf holds the smallest and largest username and
+ * email stored in it, cut to a fixed prefix, so a filtered scan can pass
+ * over leaves that cannot match without reading their rows. The bounds may
+ * be wider than the rows (updates only widen them) but never narrower.
+ * */
+constexpr uint32_t ZONE_MAP_PREFIX_SIZE = 16;
+constexpr uint32_t ZONE_MAP_NUM_COLUMNS = 2;
+constexpr uint32_t LEAF_NODE_ZONE_MAP_SIZE =
+    ZONE_MAP_NUM_COLUMNS * 2 * ZONE_MAP_PREFIX_SIZE;
+constexpr uint32_t LEAF_NODE_ZONE_MAP_OFFSET =
+    PAGE_SIZE - LEAF_NODE_ZONE_MAP_SIZE;
+
+enum ZoneMapColumn {
+  ZONE_MAP_USERNAME,
+  ZONE_MAP_EMAIL
+};
 
 /*
  * Leaf Node Body Layout.
  * */
-constexpr uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-constexpr uint32_t LEAF_NODE_KEY_OFFSET = 0;
-constexpr uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-constexpr uint32_t
-    LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-constexpr uint32_t
-    LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-constexpr uint32_t
-    LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
+constexpr uint32_t LEAF_NODE_SPACE_FOR_CELLS =
+    PAGE_SIZE - LEAF_NODE_HEADER_SIZE - LEAF_NODE_ZONE_MAP_SIZE;
+
+template<typename Key>
+struct LeafNodeLayout {
+  static constexpr uint32_t KEY_SIZE = KeyTraits<Key>::SIZE;
+  static constexpr uint32_t KEY_OFFSET = 0;
+  static constexpr uint32_t VALUE_SIZE = ROW_SIZE;
+  static constexpr uint32_t VALUE_OFFSET = KEY_OFFSET + KEY_SIZE;
+  static constexpr uint32_t CELL_SIZE = KEY_SIZE + VALUE_SIZE;
+  static constexpr uint32_t MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / CELL_SIZE;
+  static constexpr uint32_t RIGHT_SPLIT_COUNT = (MAX_CELLS + 1) / 2;
+  static constexpr uint32_t LEFT_SPLIT_COUNT =
+      (MAX_CELLS + 1) - RIGHT_SPLIT_COUNT;
+};
+
+constexpr uint32_t LEAF_NODE_KEY_SIZE = LeafNodeLayout<TableKey>::KEY_SIZE;
+constexpr uint32_t LEAF_NODE_KEY_OFFSET = LeafNodeLayout<TableKey>::KEY_OFFSET;
+constexpr uint32_t LEAF_NODE_VALUE_SIZE = LeafNodeLayout<TableKey>::VALUE_SIZE;
 constexpr uint32_t
-    LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
+    LEAF_NODE_VALUE_OFFSET = LeafNodeLayout<TableKey>::VALUE_OFFSET;
+constexpr uint32_t LEAF_NODE_CELL_SIZE = LeafNodeLayout<TableKey>::CELL_SIZE;
+constexpr uint32_t LEAF_NODE_MAX_CELLS = LeafNodeLayout<TableKey>::MAX_CELLS;
 
-constexpr uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
+constexpr uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT =
+    LeafNodeLayout<TableKey>::RIGHT_SPLIT_COUNT;
 constexpr uint32_t LEAF_NODE_LEFT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+    LeafNodeLayout<TableKey>::LEFT_SPLIT_COUNT;
 
 /*
  * Internal Node layout.
@@ -60,24 +110,72 @@ constexpr uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 constexpr uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 constexpr uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
     INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+constexpr uint32_t INTERNAL_NODE_RIGHT_CHILD_COUNT_SIZE = sizeof(uint32_t);
+constexpr uint32_t INTERNAL_NODE_RIGHT_CHILD_COUNT_OFFSET =
+    INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
 constexpr uint32_t INTERNAL_NODE_HEADER_SIZE =
     COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE
-        + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+        + INTERNAL_NODE_RIGHT_CHILD_SIZE + INTERNAL_NODE_RIGHT_CHILD_COUNT_SIZE;
 
 /*
  * Internal node body layout.
+ *
+ * Every child pointer is paired with the number of rows in that child's
+ * subtree (the right child's count lives in the header), which lets COUNT
+ * and OFFSET be answered by a descent instead of a scan.
  * */
+constexpr uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+constexpr uint32_t INTERNAL_NODE_CHILD_COUNT_SIZE = sizeof(uint32_t);
+constexpr uint32_t INTERNAL_NODE_CHILD_COUNT_OFFSET = INTERNAL_NODE_CHILD_SIZE;
+
+template<typename Key>
+struct InternalNodeLayout {
+  static constexpr uint32_t KEY_SIZE = KeyTraits<Key>::SIZE;
+  static constexpr uint32_t KEY_OFFSET =
+      INTERNAL_NODE_CHILD_COUNT_OFFSET + INTERNAL_NODE_CHILD_COUNT_SIZE;
+  static constexpr uint32_t CELL_SIZE = KEY_OFFSET + KEY_SIZE;
+  static constexpr uint32_t MAX_CELLS =
+      (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / CELL_SIZE;
+};
 
-constexpr uint32_t internal_node_key_size = sizeof(uint32_t);
-constexpr uint32_t internal_node_child_size = sizeof(uint32_t);
 constexpr uint32_t
-    internal_node_cell_size = internal_node_key_size + internal_node_child_size;
+    INTERNAL_NODE_KEY_SIZE = InternalNodeLayout<TableKey>::KEY_SIZE;
+constexpr uint32_t
+    INTERNAL_NODE_CELL_SIZE = InternalNodeLayout<TableKey>::CELL_SIZE;
+constexpr uint32_t
+    INTERNAL_NODE_MAX_CELLS = InternalNodeLayout<TableKey>::MAX_CELLS;
 
+/*
+ * Write buffer layout.
+ *
+ * With write buffering on (see Table::write_buffering) an internal root
+ * gives the back half of its page to inserts that have not been pushed down
+ * to a leaf yet. A message is a leaf cell, kept sorted by key after a count,
+ * so a batch going to one leaf can be merged into it cell by cell.
+ * */
+constexpr uint32_t INTERNAL_NODE_BUFFER_SIZE = PAGE_SIZE / 2;
+constexpr uint32_t INTERNAL_NODE_BUFFER_OFFSET =
+    PAGE_SIZE - INTERNAL_NODE_BUFFER_SIZE;
+constexpr uint32_t INTERNAL_NODE_BUFFER_COUNT_SIZE = sizeof(uint32_t);
+constexpr uint32_t INTERNAL_NODE_BUFFER_MESSAGES_OFFSET =
+    INTERNAL_NODE_BUFFER_OFFSET + INTERNAL_NODE_BUFFER_COUNT_SIZE;
 
-constexpr uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
-constexpr uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-constexpr uint32_t
-    INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+template<typename Key>
+struct InternalNodeBufferLayout {
+  static constexpr uint32_t MESSAGE_SIZE = LeafNodeLayout<Key>::CELL_SIZE;
+  static constexpr uint32_t MAX_MESSAGES =
+      (INTERNAL_NODE_BUFFER_SIZE - INTERNAL_NODE_BUFFER_COUNT_SIZE)
+          / MESSAGE_SIZE;
+  // The cells of a buffering node have to stay out of the buffer.
+  static constexpr uint32_t MAX_CELLS =
+      (INTERNAL_NODE_BUFFER_OFFSET - INTERNAL_NODE_HEADER_SIZE)
+          / InternalNodeLayout<Key>::CELL_SIZE;
+};
+
+uint32_t *node_parent(void *node) {
+  return reinterpret_cast<uint32_t *>(static_cast<char *>(node)
+      + PARENT_POINTER_OFFSET);
+}
 
 uint32_t *internal_node_num_keys(std::byte *node) {
   return reinterpret_cast<uint32_t *>(node + INTERNAL_NODE_NUM_KEYS_OFFSET);
@@ -87,11 +185,23 @@ uint32_t *internal_node_right_child(std::byte *node) {
   return reinterpret_cast<uint32_t *>(node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
 }
 
+template<typename Key = TableKey>
 uint32_t *internal_node_cell(std::byte *node, uint32_t cell_num) {
   return reinterpret_cast<uint32_t *>(node + INTERNAL_NODE_HEADER_SIZE
-      + cell_num * INTERNAL_NODE_CELL_SIZE);
+      + cell_num * InternalNodeLayout<Key>::CELL_SIZE);
+}
+
+uint32_t *internal_node_buffer_count(std::byte *node) {
+  return reinterpret_cast<uint32_t *>(node + INTERNAL_NODE_BUFFER_OFFSET);
 }
 
+template<typename Key = TableKey>
+std::byte *internal_node_buffer_message(std::byte *node, uint32_t message_num) {
+  return node + INTERNAL_NODE_BUFFER_MESSAGES_OFFSET
+      + message_num * InternalNodeBufferLayout<Key>::MESSAGE_SIZE;
+}
+
+template<typename Key = TableKey>
 uint32_t *internal_node_child(std::byte *node, uint32_t child_num) {
   uint32_t num_keys = *internal_node_num_keys(node);
   if (child_num > num_keys) {
@@ -101,12 +211,42 @@ uint32_t *internal_node_child(std::byte *node, uint32_t child_num) {
   } else if (child_num == num_keys) {
     return internal_node_right_child(node);
   } else {
-    return internal_node_cell(node, child_num);
+    return internal_node_cell<Key>(node, child_num);
   }
 }
 
-uint32_t *internal_node_key(std::byte *node, uint32_t key_num) {
-  return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+/*
+ * Keys are copied in and out of cells through KeyTraits since cells are
+ * not aligned for the key type.
+ * */
+template<typename Key = TableKey>
+Key internal_node_key(std::byte *node, uint32_t key_num) {
+  return KeyTraits<Key>::load(
+      reinterpret_cast<std::byte *>(internal_node_cell<Key>(node, key_num))
+          + InternalNodeLayout<Key>::KEY_OFFSET);
+}
+
+template<typename Key = TableKey>
+void set_internal_node_key(std::byte *node,
+                           uint32_t key_num,
+                           KeyArg<Key> key) {
+  KeyTraits<Key>::store(
+      reinterpret_cast<std::byte *>(internal_node_cell<Key>(node, key_num))
+          + InternalNodeLayout<Key>::KEY_OFFSET, key);
+}
+
+/*
+ * Number of rows below child child_num.
+ * */
+template<typename Key = TableKey>
+uint32_t *internal_node_child_count(std::byte *node, uint32_t child_num) {
+  if (child_num == *internal_node_num_keys(node)) {
+    return reinterpret_cast<uint32_t *>(node
+        + INTERNAL_NODE_RIGHT_CHILD_COUNT_OFFSET);
+  }
+  return reinterpret_cast<uint32_t *>(
+      reinterpret_cast<std::byte *>(internal_node_cell<Key>(node, child_num))
+          + INTERNAL_NODE_CHILD_COUNT_OFFSET);
 }
 
 uint32_t *leaf_node_num_cells(void *node) {
@@ -114,18 +254,41 @@ uint32_t *leaf_node_num_cells(void *node) {
       + LEAF_NODE_NUM_CELLS_OFFSET);
 }
 
+// Cells at the end of the leaf appended out of key order.
+uint32_t *leaf_node_num_unsorted(void *node) {
+  return reinterpret_cast<uint32_t *>(static_cast<char *>(node)
+      + LEAF_NODE_NUM_UNSORTED_OFFSET);
+}
+
+/*
+ * Page number of the right sibling leaf. 0 means this is the rightmost leaf,
+ * page 0 is the database header and therefore never a sibling.
+ * */
+uint32_t *leaf_node_next_leaf(void *node) {
+  return reinterpret_cast<uint32_t *>(static_cast<char *>(node)
+      + LEAF_NODE_NEXT_LEAF_OFFSET);
+}
+
+template<typename Key = TableKey>
 void *leaf_node_cell(void *node, uint32_t cell_num) {
   return static_cast<char *> (node) + LEAF_NODE_HEADER_SIZE
-      + cell_num * LEAF_NODE_CELL_SIZE;
+      + cell_num * LeafNodeLayout<Key>::CELL_SIZE;
+}
+
+template<typename Key = TableKey>
+Key leaf_node_key(void *node, uint32_t cell_num) {
+  return KeyTraits<Key>::load(leaf_node_cell<Key>(node, cell_num));
 }
 
-uint32_t *leaf_node_key(void *node, uint32_t cell_num) {
-  return static_cast<uint32_t *>(leaf_node_cell(node, cell_num));
+template<typename Key = TableKey>
+void set_leaf_node_key(void *node, uint32_t cell_num, KeyArg<Key> key) {
+  KeyTraits<Key>::store(leaf_node_cell<Key>(node, cell_num), key);
 }
 
+template<typename Key = TableKey>
 void *leaf_node_value(void *node, uint32_t cell_num) {
-  return static_cast<char *>(leaf_node_cell(node, cell_num))
-      + LEAF_NODE_KEY_SIZE;
+  return static_cast<char *>(leaf_node_cell<Key>(node, cell_num))
+      + LeafNodeLayout<Key>::VALUE_OFFSET;
 }
 
 NodeType get_node_type(void *node) {
@@ -139,24 +302,318 @@ void set_node_type(void *node, NodeType type) {
   *((uint8_t *) (static_cast<char *>(node) + NODE_TYPE_OFFSET)) = value;
 }
 
-void initialize_leaf_node(void *node) {
-  set_node_type(node, NODE_LEAF);
-  *leaf_node_num_cells(node) = 0;
-}
-
 void set_node_root(void *node, bool is_root) {
   uint8_t value = is_root;
   *((uint8_t *) (static_cast<char *>(node) + IS_ROOT_OFFSET)) = value;
 }
 
+bool is_node_root(std::byte *node) {
+  uint8_t value = *((uint8_t *) (node + IS_ROOT_OFFSET));
+  return (bool) value;
+}
+
+char *leaf_node_zone_min(std::byte *node, ZoneMapColumn column) {
+  return reinterpret_cast<char *>(node + LEAF_NODE_ZONE_MAP_OFFSET
+      + column * 2 * ZONE_MAP_PREFIX_SIZE);
+}
+
+char *leaf_node_zone_max(std::byte *node, ZoneMapColumn column) {
+  return leaf_node_zone_min(node, column) + ZONE_MAP_PREFIX_SIZE;
+}
+
+uint32_t zone_map_column_offset(ZoneMapColumn column) {
+  return column == ZONE_MAP_USERNAME ? USERNAME_OFFSET : EMAIL_OFFSET;
+}
+
+uint32_t zone_map_column_size(ZoneMapColumn column) {
+  return column == ZONE_MAP_USERNAME ? USERNAME_SIZE : EMAIL_SIZE;
+}
+
+/*
+ * First ZONE_MAP_PREFIX_SIZE bytes of value, zero padded after its
+ * terminator so prefixes compare the way the strings do.
+ * */
+void zone_map_prefix(const char *value, uint32_t size, char *prefix) {
+  memset(prefix, 0, ZONE_MAP_PREFIX_SIZE);
+  memcpy(prefix, value, strnlen(value, std::min(size, ZONE_MAP_PREFIX_SIZE)));
+}
+
+/*
+ * Widen the zone map of node to cover the serialized row. is_first resets
+ * it to just that row.
+ * */
+void leaf_node_zone_map_add(std::byte *node, const std::byte *row,
+                            bool is_first) {
+  for (auto column: {ZONE_MAP_USERNAME, ZONE_MAP_EMAIL}) {
+    char prefix[ZONE_MAP_PREFIX_SIZE];
+    zone_map_prefix(reinterpret_cast<const char *>(row)
+                        + zone_map_column_offset(column),
+                    zone_map_column_size(column), prefix);
+    char *min = leaf_node_zone_min(node, column);
+    char *max = leaf_node_zone_max(node, column);
+    if (is_first || memcmp(prefix, min, ZONE_MAP_PREFIX_SIZE) < 0) {
+      memcpy(min, prefix, ZONE_MAP_PREFIX_SIZE);
+    }
+    if (is_first || memcmp(prefix, max, ZONE_MAP_PREFIX_SIZE) > 0) {
+      memcpy(max, prefix, ZONE_MAP_PREFIX_SIZE);
+    }
+  }
+}
+
+/*
+ * False only when no row of node can have value in column.
+ * */
+bool leaf_node_zone_map_may_contain(std::byte *node,
+                                    ZoneMapColumn column,
+                                    const char *value) {
+  char prefix[ZONE_MAP_PREFIX_SIZE];
+  zone_map_prefix(value, zone_map_column_size(column), prefix);
+  return memcmp(prefix, leaf_node_zone_min(node, column),
+                ZONE_MAP_PREFIX_SIZE) >= 0
+      && memcmp(prefix, leaf_node_zone_max(node, column),
+                ZONE_MAP_PREFIX_SIZE) <= 0;
+}
+
+/*
+ * False only when no row of node can have a value in column that starts
+ * with the length bytes of prefix. The zone map keeps the first
+ * ZONE_MAP_PREFIX_SIZE bytes of the smallest and largest value, so only
+ * that much of prefix is compared against them.
+ * */
+bool leaf_node_zone_map_may_have_prefix(std::byte *node,
+                                        ZoneMapColumn column,
+                                        const char *prefix,
+                                        uint32_t length) {
+  length = std::min(length, ZONE_MAP_PREFIX_SIZE);
+  return memcmp(prefix, leaf_node_zone_min(node, column), length) >= 0
+      && memcmp(prefix, leaf_node_zone_max(node, column), length) <= 0;
+}
+
+/*
+ * Recompute the zone map of node from the rows it holds.
+ * */
+template<typename Key = TableKey>
+void leaf_node_zone_map_rebuild(std::byte *node) {
+  for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
+    leaf_node_zone_map_add(
+        node, static_cast<std::byte *>(leaf_node_value<Key>(node, i)), i == 0);
+  }
+}
+
+void initialize_leaf_node(void *node) {
+  set_node_type(node, NODE_LEAF);
+  set_node_root(node, false);
+  *leaf_node_num_cells(node) = 0;
+  *leaf_node_next_leaf(node) = 0;
+  *leaf_node_num_unsorted(node) = 0;
+}
+
 void initialize_internal_node(std::byte *node) {
   set_node_type(node, NODE_INTERNAL);
   set_node_root(node, false);
   *internal_node_num_keys(node) = 0;
 }
 
+/*
+ * Largest key stored in the subtree rooted at node. For an internal node this
+ * is the max key of its right child, which is cheaper than tracking it.
+ * */
+template<typename Key = TableKey>
+Key get_node_max_key(Pager *pager, std::byte *node) {
+  while (get_node_type(node) == NODE_INTERNAL) {
+    node = pager->get_page(*internal_node_right_child(node));
+  }
+
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t num_sorted = num_cells - *leaf_node_num_unsorted(node);
+  Key max_key = leaf_node_key<Key>(node, num_cells - 1);
+  for (uint32_t i = num_sorted > 0 ? num_sorted - 1 : 0; i < num_cells; i++) {
+    Key key = leaf_node_key<Key>(node, i);
+    if (key_less(max_key, key)) {
+      max_key = key;
+    }
+  }
+  return max_key;
+}
+
+/*
+ * Smallest key stored in the subtree rooted at node, from its leftmost
+ * leaf: the first sorted cell or a smaller one in the append region.
+ * */
+template<typename Key = TableKey>
+Key get_node_min_key(Pager *pager, std::byte *node) {
+  while (get_node_type(node) == NODE_INTERNAL) {
+    node = pager->get_page(*internal_node_child(node, 0));
+  }
+
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t num_sorted = num_cells - *leaf_node_num_unsorted(node);
+  Key min_key = leaf_node_key<Key>(node, 0);
+  for (uint32_t i = num_sorted; i < num_cells; i++) {
+    Key key = leaf_node_key<Key>(node, i);
+    if (key_less(key, min_key)) {
+      min_key = key;
+    }
+  }
+  return min_key;
+}
+
+/*
+ * Cell of node holding key: a binary search of the sorted cells, then a
+ * look through the append region. When key is absent found is false and
+ * the result is where key would go among the sorted cells.
+ * */
+template<typename Key = TableKey>
+uint32_t leaf_node_find_cell(std::byte *node, KeyArg<Key> key, bool &found) {
+  // Bounded so an optimistic reader with torn counts stays in the page.
+  uint32_t num_cells =
+      std::min(*leaf_node_num_cells(node), LeafNodeLayout<Key>::MAX_CELLS);
+  uint32_t num_unsorted =
+      std::min(*leaf_node_num_unsorted(node), LEAF_NODE_MAX_UNSORTED);
+  uint32_t num_sorted = num_cells - std::min(num_unsorted, num_cells);
+  found = false;
+
+  for (uint32_t i = num_sorted; i < num_cells; i++) {
+    if (key_equal(key, leaf_node_key<Key>(node, i))) {
+      found = true;
+      return i;
+    }
+  }
+
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index = num_sorted;
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    Key key_at_index = leaf_node_key<Key>(node, index);
+
+    if (key_equal(key, key_at_index)) {
+      found = true;
+      return index;
+    }
+
+    if (key_less(key, key_at_index)) {
+      one_past_max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  return min_index;
+}
+
+/*
+ * Merge count cells, sorted by key, into the sorted cells of node. Cells are
+ * moved from the back, so each existing cell moves at most once however
+ * many are merged in. The caller makes sure they fit.
+ * */
+template<typename Key = TableKey>
+void leaf_node_merge_cells(std::byte *node,
+                           uint32_t num_sorted,
+                           const std::byte *cells,
+                           uint32_t count) {
+  using Layout = LeafNodeLayout<Key>;
+  uint32_t old_index = num_sorted;
+  uint32_t new_index = count;
+  for (uint32_t i = num_sorted + count; i > 0 && new_index > 0; i--) {
+    const std::byte *new_cell = cells + (new_index - 1) * Layout::CELL_SIZE;
+    bool take_new = old_index == 0
+        || key_less(leaf_node_key<Key>(node, old_index - 1),
+                    KeyTraits<Key>::load(new_cell + Layout::KEY_OFFSET));
+    if (take_new) {
+      memcpy(leaf_node_cell<Key>(node, i - 1), new_cell, Layout::CELL_SIZE);
+      new_index--;
+    } else {
+      memcpy(leaf_node_cell<Key>(node, i - 1),
+             leaf_node_cell<Key>(node, old_index - 1),
+             Layout::CELL_SIZE);
+      old_index--;
+    }
+  }
+}
+
+/*
+ * Sort the append region of node into its other cells.
+ * */
+template<typename Key = TableKey>
+void leaf_node_merge_unsorted(std::byte *node) {
+  using Layout = LeafNodeLayout<Key>;
+  uint32_t count = *leaf_node_num_unsorted(node);
+  if (count == 0) {
+    return;
+  }
+
+  uint32_t num_sorted = *leaf_node_num_cells(node) - count;
+  std::byte region[LEAF_NODE_MAX_UNSORTED * Layout::CELL_SIZE];
+  memcpy(region, leaf_node_cell<Key>(node, num_sorted),
+         count * Layout::CELL_SIZE);
+
+  // Insertion sort, the region is a handful of cells.
+  std::byte cell[Layout::CELL_SIZE];
+  for (uint32_t i = 1; i < count; i++) {
+    memcpy(cell, region + i * Layout::CELL_SIZE, Layout::CELL_SIZE);
+    Key key = KeyTraits<Key>::load(cell + Layout::KEY_OFFSET);
+    uint32_t j = i;
+    while (j > 0 && key_less(key, KeyTraits<Key>::load(
+        region + (j - 1) * Layout::CELL_SIZE + Layout::KEY_OFFSET))) {
+      memcpy(region + j * Layout::CELL_SIZE,
+             region + (j - 1) * Layout::CELL_SIZE,
+             Layout::CELL_SIZE);
+      j--;
+    }
+    memcpy(region + j * Layout::CELL_SIZE, cell, Layout::CELL_SIZE);
+  }
+
+  leaf_node_merge_cells<Key>(node, num_sorted, region, count);
+  *leaf_node_num_unsorted(node) = 0;
+}
+
+/*
+ * Rows in the subtree rooted at node. For an internal node this is the sum
+ * of its child counts, no children are read.
+ * */
+template<typename Key = TableKey>
+uint32_t get_node_row_count(std::byte *node) {
+  if (get_node_type(node) == NODE_LEAF) {
+    return *leaf_node_num_cells(node);
+  }
+
+  uint32_t count = 0;
+  for (uint32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+    count += *internal_node_child_count<Key>(node, i);
+  }
+  return count;
+}
+
+/*
+ * Index of the child which should contain the given key. Keys in an internal
+ * node are the max key of the child to their left.
+ * */
+template<typename Key = TableKey>
+uint32_t internal_node_find_child(std::byte *node, KeyArg<Key> key) {
+  // An optimistic reader can see a count torn by a concurrent writer. It
+  // restarts anyway, but must not search past the end of the page first.
+  uint32_t num_keys = std::min(*internal_node_num_keys(node),
+                               InternalNodeLayout<Key>::MAX_CELLS);
+
+  uint32_t min_index = 0;
+  uint32_t max_index = num_keys; // There is one more child than keys.
+
+  while (min_index != max_index) {
+    uint32_t index = (min_index + max_index) / 2;
+    Key key_to_right = internal_node_key<Key>(node, index);
+    if (!key_less(key_to_right, key)) {
+      max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  return min_index;
+}
+
 void print_constants() {
   std::cout << "ROW_SIZE: " << ROW_SIZE << std::endl;
+  std::cout << "EMAIL_INLINE_SIZE: " << EMAIL_INLINE_SIZE << std::endl;
   std::cout << "COMMON_NODE_HEADER_SIZE: " << COMMON_NODE_HEADER_SIZE
             << std::endl;
   std::cout << "LEAF_NODE_HEADER_SIZE: " << LEAF_NODE_HEADER_SIZE << std::endl;
@@ -164,15 +621,60 @@ void print_constants() {
   std::cout << "LEAF_NODE_SPACE_FOR_CELLS: " << LEAF_NODE_SPACE_FOR_CELLS
             << std::endl;
   std::cout << "LEAF_NODE_MAX_CELLS: " << LEAF_NODE_MAX_CELLS << std::endl;
+  std::cout << "INTERNAL_NODE_MAX_CELLS: " << INTERNAL_NODE_MAX_CELLS
+            << std::endl;
+  std::cout << "INTERNAL_NODE_BUFFER_MAX_MESSAGES: "
+            << InternalNodeBufferLayout<TableKey>::MAX_MESSAGES << std::endl;
 }
 
+template<typename Key = TableKey>
 void print_leaf_node(void *node) {
   uint32_t num_cells = *leaf_node_num_cells(node);
-  std::cout << "Leaf (size " << num_cells << ")" << std::endl;
+  std::cout << "Leaf (size " << num_cells << ", unsorted "
+            << *leaf_node_num_unsorted(node) << ")" << std::endl;
   for (uint32_t i = 0; i < num_cells; i++) {
-    uint32_t key = *leaf_node_key(node, i);
+    Key key = leaf_node_key<Key>(node, i);
     std::cout << "  - " << i << " : " << key << std::endl;
   }
 }
 
+void indent(uint32_t level) {
+  for (uint32_t i = 0; i < level; i++) {
+    std::cout << "  ";
+  }
+}
+
+template<typename Key = TableKey>
+void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level) {
+  std::byte *node = pager->get_page(page_num);
+
+  switch (get_node_type(node)) {
+    case NODE_LEAF: {
+      uint32_t num_cells = *leaf_node_num_cells(node);
+      indent(indentation_level);
+      std::cout << "- leaf (size " << num_cells << ")" << std::endl;
+      for (uint32_t i = 0; i < num_cells; i++) {
+        indent(indentation_level + 1);
+        std::cout << "- " << leaf_node_key<Key>(node, i) << std::endl;
+      }
+      break;
+    }
+    case NODE_INTERNAL: {
+      uint32_t num_keys = *internal_node_num_keys(node);
+      indent(indentation_level);
+      std::cout << "- internal (size " << num_keys << ", rows "
+                << get_node_row_count<Key>(node) << ")" << std::endl;
+      for (uint32_t i = 0; i < num_keys; i++) {
+        print_tree<Key>(pager, *internal_node_child<Key>(node, i),
+                        indentation_level + 1);
+        indent(indentation_level + 1);
+        std::cout << "- key " << internal_node_key<Key>(node, i) << std::endl;
+      }
+      print_tree<Key>(pager, *internal_node_right_child(node),
+                      indentation_level + 1);
+      break;
+    }
+  }
+}
+
 #endif //RK_SQLLITE_NODE_H
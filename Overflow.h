@@ -0,0 +1,193 @@
+#ifndef RK_SQLLITE_OVERFLOW_H
+#define RK_SQLLITE_OVERFLOW_H
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include "Pager.h"
+
+/*
+ * Overflow pages hold the part of a value that does not fit in its cell.
+ * Each page is cut into slots of OVERFLOW_SLOT_SIZE bytes, so one page
+ * holds the overflow of many short values. A page starts with the number
+ * of its slots taken; slots are handed out in order from the page the
+ * pager has open for them, and a new page is opened once it is full.
+ *
+ * A slot is the number of the slot that carries on the value, then
+ * OVERFLOW_SLOT_DATA_SIZE bytes of it. A value longer than that goes on
+ * in a chain of slots, on as many pages as it takes. The cell keeps the
+ * value's length, which says how many slots of the chain it uses.
+ *
+ * A value refers to its first slot by page number * OVERFLOW_SLOTS_PER_PAGE
+ * + slot number. Page 0 is the database header, so 0 means no slot.
+ * */
+const uint32_t OVERFLOW_NUM_SLOTS_SIZE = sizeof(uint32_t);
+const uint32_t OVERFLOW_NUM_SLOTS_OFFSET = 0;
+const uint32_t OVERFLOW_HEADER_SIZE = OVERFLOW_NUM_SLOTS_SIZE;
+const uint32_t OVERFLOW_SLOT_SIZE = 192;
+const uint32_t OVERFLOW_SLOTS_PER_PAGE =
+    (PAGE_SIZE - OVERFLOW_HEADER_SIZE) / OVERFLOW_SLOT_SIZE;
+
+const uint32_t OVERFLOW_SLOT_NEXT_SIZE = sizeof(uint32_t);
+const uint32_t OVERFLOW_SLOT_NEXT_OFFSET = 0;
+const uint32_t OVERFLOW_SLOT_DATA_OFFSET =
+    OVERFLOW_SLOT_NEXT_OFFSET + OVERFLOW_SLOT_NEXT_SIZE;
+const uint32_t OVERFLOW_SLOT_DATA_SIZE =
+    OVERFLOW_SLOT_SIZE - OVERFLOW_SLOT_DATA_OFFSET;
+
+/*
+ * Most pages writing length bytes of overflow can take from the pager.
+ * */
+constexpr uint32_t overflow_max_new_pages(uint32_t length) {
+  uint32_t num_slots =
+      (length + OVERFLOW_SLOT_DATA_SIZE - 1) / OVERFLOW_SLOT_DATA_SIZE;
+  return (num_slots + OVERFLOW_SLOTS_PER_PAGE - 1) / OVERFLOW_SLOTS_PER_PAGE;
+}
+
+uint32_t *overflow_num_slots(std::byte *page) {
+  return reinterpret_cast<uint32_t *>(page + OVERFLOW_NUM_SLOTS_OFFSET);
+}
+
+/*
+ * The bytes of slot, null for 0 or for a slot that cannot be in the file,
+ * which is what a reader racing a writer may see before it validates.
+ * */
+std::byte *overflow_slot(Pager *pager, uint32_t slot) {
+  uint32_t page_num = slot / OVERFLOW_SLOTS_PER_PAGE;
+  if (page_num == 0 || page_num >= TABLE_MAX_PAGES) {
+    return nullptr;
+  }
+  return pager->get_page(page_num) + OVERFLOW_HEADER_SIZE
+      + slot % OVERFLOW_SLOTS_PER_PAGE * OVERFLOW_SLOT_SIZE;
+}
+
+uint32_t *overflow_slot_next(std::byte *slot_bytes) {
+  return reinterpret_cast<uint32_t *>(slot_bytes + OVERFLOW_SLOT_NEXT_OFFSET);
+}
+
+/*
+ * Take the next free slot, opening a new page when the open one is full.
+ * The slot ends its chain until something is linked after it.
+ * */
+uint32_t overflow_allocate_slot(Pager *pager) {
+  uint32_t page_num = pager->get_overflow_page_num();
+  if (page_num == 0
+      || *overflow_num_slots(pager->get_page(page_num))
+          == OVERFLOW_SLOTS_PER_PAGE) {
+    page_num = pager->get_unused_page_num();
+    *overflow_num_slots(pager->get_page(page_num)) = 0;
+    pager->set_overflow_page_num(page_num);
+  }
+  uint32_t *num_slots = overflow_num_slots(pager->get_page(page_num));
+  uint32_t slot = page_num * OVERFLOW_SLOTS_PER_PAGE + (*num_slots)++;
+  *overflow_slot_next(overflow_slot(pager, slot)) = 0;
+  return slot;
+}
+
+/*
+ * Write length bytes of data to the chain starting at slot and return its
+ * first slot, 0 if nothing had to be written.
+ *
+ * slot is the chain the value used before, or 0. It is written over, and
+ * new slots only taken past its end. A shorter value leaves the rest of
+ * the chain linked, and one with nothing to spill keeps its slot, so the
+ * next longer value written to the same cell takes them back.
+ * */
+uint32_t overflow_write(Pager *pager,
+                        const char *data,
+                        uint32_t length,
+                        uint32_t slot) {
+  if (length == 0) {
+    return slot;
+  }
+  if (slot == 0) {
+    slot = overflow_allocate_slot(pager);
+  }
+
+  std::byte *slot_bytes = overflow_slot(pager, slot);
+  while (true) {
+    uint32_t chunk = std::min(length, OVERFLOW_SLOT_DATA_SIZE);
+    memcpy(slot_bytes + OVERFLOW_SLOT_DATA_OFFSET, data, chunk);
+    data += chunk;
+    length -= chunk;
+    if (length == 0) {
+      return slot;
+    }
+    uint32_t *next = overflow_slot_next(slot_bytes);
+    if (*next == 0) {
+      *next = overflow_allocate_slot(pager);
+    }
+    slot_bytes = overflow_slot(pager, *next);
+  }
+}
+
+/*
+ * Call visit(bytes, size) for each piece of the first length bytes of the
+ * chain starting at slot, in order, until it returns false. Stops early
+ * at a slot that cannot be in the file. Returns whether every piece was
+ * visited.
+ * */
+template<typename Visit>
+bool overflow_visit(Pager *pager, uint32_t slot, uint32_t length, Visit visit) {
+  while (length > 0) {
+    std::byte *slot_bytes = overflow_slot(pager, slot);
+    if (slot_bytes == nullptr) {
+      return false;
+    }
+    uint32_t chunk = std::min(length, OVERFLOW_SLOT_DATA_SIZE);
+    if (!visit(reinterpret_cast<const char *>(slot_bytes
+                                                  + OVERFLOW_SLOT_DATA_OFFSET),
+               chunk)) {
+      return false;
+    }
+    length -= chunk;
+    slot = *overflow_slot_next(slot_bytes);
+  }
+  return true;
+}
+
+/*
+ * Copy length bytes of the chain starting at slot into destination.
+ * */
+void overflow_read(Pager *pager,
+                   uint32_t slot,
+                   char *destination,
+                   uint32_t length) {
+  overflow_visit(pager, slot, length,
+                 [&destination](const char *bytes, uint32_t size) {
+    memcpy(destination, bytes, size);
+    destination += size;
+    return true;
+  });
+}
+
+/*
+ * Whether the first length bytes of the chain are data, compared where
+ * they lie in the pages.
+ * */
+bool overflow_equals(Pager *pager,
+                     uint32_t slot,
+                     const char *data,
+                     uint32_t length) {
+  return overflow_visit(pager, slot, length,
+                        [&data](const char *bytes, uint32_t size) {
+    bool equal = memcmp(bytes, data, size) == 0;
+    data += size;
+    return equal;
+  });
+}
+
+/*
+ * Write length bytes of the chain to out, straight from the pages.
+ * */
+void overflow_print(std::ostream &out,
+                    Pager *pager,
+                    uint32_t slot,
+                    uint32_t length) {
+  overflow_visit(pager, slot, length, [&out](const char *bytes, uint32_t size) {
+    out.write(bytes, size);
+    return true;
+  });
+}
+
+#endif //RK_SQLLITE_OVERFLOW_H
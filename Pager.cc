@@ -1,6 +1,7 @@
 //
 // Created by Rahul Kushwaha on 10/11/21.
 //
+#include <cstdlib>
 #include <fcntl.h>
 #include <iostream>
 #include <unistd.h>
@@ -28,7 +29,9 @@ void Pager::flush(uint32_t page_num) {
   std::cout << "Successfully flushed page: " << page_num << std::endl;
 }
 
-Pager::Pager(const std::string &filename) : file_descriptor(-1) {
+Pager::Pager(const std::string &filename)
+    : file_descriptor(-1), temp_file_descriptor(-1), num_temp_pages(0),
+      overflow_page_num(0) {
   // O_RDWR => Read/Write mode.
   // O_CREAT => Create file if it does not exist.
   // S_IWUSR => User write permission.
@@ -66,6 +69,10 @@ Pager::~Pager() {
     delete pages[i];
   }
 
+  if (temp_file_descriptor != -1) {
+    close(temp_file_descriptor);
+  }
+
   if (file_descriptor != -1) {
     int result = close(file_descriptor);
     if (result == -1) {
@@ -75,17 +82,44 @@ Pager::~Pager() {
   }
 }
 
-uint32_t Pager::get_unused_page_num() const {
-  return num_pages;
+uint32_t Pager::get_unused_page_num() {
+  std::lock_guard<std::mutex> guard(load_mutex);
+  if (free_pages.empty()) {
+    return num_pages;
+  }
+  uint32_t page_num = *free_pages.begin();
+  free_pages.erase(free_pages.begin());
+  return page_num;
+}
+
+uint32_t Pager::get_num_unused_pages() {
+  std::lock_guard<std::mutex> guard(load_mutex);
+  return TABLE_MAX_PAGES - num_pages + free_pages.size();
+}
+
+void Pager::free_page(uint32_t page_num) {
+  std::lock_guard<std::mutex> guard(load_mutex);
+  free_pages.insert(page_num);
+}
+
+std::set<uint32_t> Pager::get_free_pages() {
+  std::lock_guard<std::mutex> guard(load_mutex);
+  return free_pages;
 }
 
 std::byte *Pager::get_page(uint32_t page_num) {
-  if (page_num > TABLE_MAX_PAGES) {
+  if (page_num >= TABLE_MAX_PAGES) {
     std::cout << "Tried to fetch page number out of bounds." << page_num
               << " > " << TABLE_MAX_PAGES << std::endl;
-    exit(0);
+    exit(EXIT_FAILURE);
   }
 
+  std::byte *cached_page = pages[page_num].load(std::memory_order_acquire);
+  if (cached_page != nullptr) {
+    return cached_page;
+  }
+
+  std::lock_guard<std::mutex> guard(load_mutex);
   if (pages[page_num] == nullptr) {
     // Cache miss. Allocate memory and load from file.
     //void *page = malloc(PAGE_SIZE);
@@ -109,7 +143,7 @@ std::byte *Pager::get_page(uint32_t page_num) {
       }
     }
 
-    pages[page_num] = page;
+    pages[page_num].store(page, std::memory_order_release);
 
     if (page_num >= num_pages) {
       num_pages = page_num + 1;
@@ -122,3 +156,61 @@ std::byte *Pager::get_page(uint32_t page_num) {
 uint32_t Pager::get_num_pages() const {
   return num_pages;
 }
+
+uint32_t Pager::get_overflow_page_num() const {
+  return overflow_page_num;
+}
+
+void Pager::set_overflow_page_num(uint32_t page_num) {
+  overflow_page_num = page_num;
+}
+
+
+bool Pager::is_page_cached(uint32_t page_num) const {
+  return pages[page_num] != nullptr;
+}
+
+uint32_t Pager::write_temp_page(const std::byte *page) {
+  if (temp_file_descriptor == -1) {
+    char path[] = "/tmp/rk_sqllite_XXXXXX";
+    temp_file_descriptor = mkstemp(path);
+    if (temp_file_descriptor == -1) {
+      std::cout << "Unable to open temp file: " << errno << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    // Gone from the directory now, and from the disk once closed.
+    unlink(path);
+  }
+
+  ssize_t bytes_written = pwrite(temp_file_descriptor, page, PAGE_SIZE,
+                                 static_cast<off_t>(num_temp_pages)
+                                     * PAGE_SIZE);
+  if (bytes_written != PAGE_SIZE) {
+    std::cout << "Error writing temp page: " << errno << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return num_temp_pages++;
+}
+
+void Pager::read_temp_page(uint32_t temp_page_num, std::byte *page) {
+  if (temp_page_num >= num_temp_pages) {
+    std::cout << "Tried to read temp page " << temp_page_num << " of "
+              << num_temp_pages << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  ssize_t bytes_read = pread(temp_file_descriptor, page, PAGE_SIZE,
+                             static_cast<off_t>(temp_page_num) * PAGE_SIZE);
+  if (bytes_read != PAGE_SIZE) {
+    std::cout << "Error reading temp page: " << errno << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+void Pager::release_temp_pages() {
+  if (temp_file_descriptor != -1 && ftruncate(temp_file_descriptor, 0) == -1) {
+    std::cout << "Error truncating temp file: " << errno << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  num_temp_pages = 0;
+}
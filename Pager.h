@@ -5,7 +5,10 @@
 #ifndef RK_SQLLITE_PAGER_H
 #define RK_SQLLITE_PAGER_H
 
+#include <atomic>
 #include <cstdint>
+#include <mutex>
+#include <set>
 #include <string>
 
 #define TABLE_MAX_PAGES 100
@@ -16,14 +19,42 @@ class Pager {
   int file_descriptor;
   uint32_t file_length;
   uint32_t num_pages;
-  std::byte *pages[TABLE_MAX_PAGES]{};
+  // Cached pages are read without taking load_mutex; only a cache miss
+  // takes it, so threads racing to load the same page read it once.
+  std::atomic<std::byte *> pages[TABLE_MAX_PAGES]{};
+  std::mutex load_mutex;
+  // Scratch pages, apart from the database in an unlinked file opened on
+  // first use. -1 until then.
+  int temp_file_descriptor;
+  uint32_t num_temp_pages;
+  // Overflow page new slots are taken from, 0 for none. See Overflow.h.
+  uint32_t overflow_page_num;
+  // Pages given back with free_page, handed out again lowest first before
+  // the file grows. Guarded by load_mutex.
+  std::set<uint32_t> free_pages;
 
  public:
   explicit Pager(const std::string &filename);
   void flush(uint32_t page_num);
-  [[nodiscard]] uint32_t get_unused_page_num() const;
+  // A free page if there is one, which is then taken, else the page past
+  // the end of the file, which is taken by the get_page that follows.
+  [[nodiscard]] uint32_t get_unused_page_num();
+  // Pages get_unused_page_num can still hand out before TABLE_MAX_PAGES.
+  [[nodiscard]] uint32_t get_num_unused_pages();
+  // Give a page nothing refers to any more back for get_unused_page_num.
+  void free_page(uint32_t page_num);
+  [[nodiscard]] std::set<uint32_t> get_free_pages();
   std::byte *get_page(uint32_t page_num);
+  [[nodiscard]] bool is_page_cached(uint32_t page_num) const;
   uint32_t get_num_pages() const;
+  [[nodiscard]] uint32_t get_overflow_page_num() const;
+  void set_overflow_page_num(uint32_t page_num);
+  // Temp pages hold what a query spills when it runs out of memory. They
+  // are numbered from 0 apart from the database pages, are not cached and
+  // are all dropped together. Not safe to use from several threads.
+  uint32_t write_temp_page(const std::byte *page);
+  void read_temp_page(uint32_t temp_page_num, std::byte *page);
+  void release_temp_pages();
   ~Pager();
 };
 
@@ -0,0 +1,89 @@
+#ifndef RK_SQLLITE_PARALLEL_H
+#define RK_SQLLITE_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "Cursor.h"
+
+/*
+ * A run of leaves one scan thread reads: from start up to, not including,
+ * the leaf end_page_num, 0 meaning the end of the table.
+ * */
+struct ScanPartition {
+  Cursor start;
+  uint32_t end_page_num;
+};
+
+uint32_t default_scan_threads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+ * Split the leaf level at the root's separator keys, one partition per
+ * child, in key order. A leaf root is a single partition.
+ *
+ * Every partition's first leaf is sorted here, before any thread starts,
+ * since the thread on the partition before it steps onto that leaf to see
+ * it has reached its end. The leaves after the first are only touched by
+ * their own thread.
+ * */
+std::vector<ScanPartition> table_partition_leaves(Table *table) {
+  std::vector<ScanPartition> partitions;
+  std::byte *root = table->pager->get_page(table->root_page_num);
+  if (get_node_type(root) == NODE_LEAF) {
+    partitions.push_back({table_start(table), 0});
+    return partitions;
+  }
+
+  uint32_t num_keys = *internal_node_num_keys(root);
+  partitions.push_back({table_start(table), 0});
+  for (uint32_t i = 0; i < num_keys; i++) {
+    // Separators are the largest key of the child to their left.
+    TableKey separator = internal_node_key<TableKey>(root, i);
+    Cursor start = table_seek(table, separator + 1);
+    partitions.back().end_page_num = start.page_num;
+    partitions.push_back({start, 0});
+  }
+  return partitions;
+}
+
+/*
+ * Run scan(partition_num, cursor, end_page_num) once for every partition on
+ * up to num_threads threads. Each thread takes the next partition not yet
+ * taken when it finishes one, so a thread that drew small partitions picks
+ * up the slack of one that drew big ones.
+ *
+ * Nothing may write to the table while this runs.
+ * */
+template<typename Scan>
+void table_parallel_scan(std::vector<ScanPartition> &partitions,
+                         uint32_t num_threads,
+                         Scan scan) {
+  std::atomic<uint32_t> next_partition{0};
+  auto worker = [&]() {
+    uint32_t partition_num;
+    while ((partition_num = next_partition.fetch_add(1))
+        < partitions.size()) {
+      ScanPartition &partition = partitions[partition_num];
+      scan(partition_num, &partition.start, partition.end_page_num);
+    }
+  };
+
+  num_threads = std::min<uint32_t>(num_threads, partitions.size());
+  if (num_threads <= 1) {
+    worker();
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  for (std::thread &thread: threads) {
+    thread.join();
+  }
+}
+
+#endif //RK_SQLLITE_PARALLEL_H
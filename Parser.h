@@ -0,0 +1,443 @@
+#ifndef RK_SQLLITE_PARSER_H
+#define RK_SQLLITE_PARSER_H
+
+#include <cstdint>
+#include <string_view>
+#include "Arena.h"
+#include "MetaCommandResult.h"
+
+/*
+ * Tokenizer and recursive descent parser for statements.
+ *
+ * Tokens are views into the statement text and the tree the parser builds
+ * lives in an arena the caller resets per statement, so once the arena's
+ * first block is big enough parsing a statement allocates nothing. The tree
+ * only records what was written; whether the columns, functions and values
+ * in it make sense is for whoever turns it into a plan.
+ *
+ * statement   := insert | update | select | create
+ * insert      := "insert" literal literal literal
+ * update      := "update" "set" assignment ("," assignment)* where
+ * assignment  := WORD "=" literal
+ * select      := "select" ["unordered"] [items] [where]
+ *                ["group" "by" WORD] ["order" "by" WORD ["asc" | "desc"]]
+ *                ["limit" NUMBER ["offset" NUMBER]]
+ * items       := "distinct" WORD | item ("," item)*
+ * item        := WORD ["(" (WORD | NUMBER) ")"]
+ * where       := "where" WORD ("=" | "like" | "contains") literal
+ *              | "where" WORD "between" literal "and" literal
+ * create      := "create" "index" "on" WORD
+ * literal     := WORD | NUMBER | STRING
+ *
+ * Keywords, and the names of columns and functions, are matched ignoring
+ * case. A word runs up to white space or one of ",()="; a string is quoted
+ * in single quotes and may hold any of those but a quote.
+ * */
+enum TokenType {
+  TOKEN_END,
+  TOKEN_WORD,
+  TOKEN_NUMBER, // a word of digits that fits in 64 bits.
+  TOKEN_STRING, // text is what is between the quotes.
+  TOKEN_COMMA,
+  TOKEN_LEFT_PAREN,
+  TOKEN_RIGHT_PAREN,
+  TOKEN_EQUALS,
+  TOKEN_INVALID // a string with no closing quote.
+};
+
+struct Token {
+  TokenType type;
+  std::string_view text;
+  uint64_t number;
+};
+
+struct Tokenizer {
+  const char *position;
+  const char *end;
+};
+
+bool token_is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool token_ends_word(char c) {
+  return token_is_space(c) || c == ',' || c == '(' || c == ')' || c == '='
+      || c == '\0';
+}
+
+Token tokenizer_next(Tokenizer &tokenizer) {
+  const char *&position = tokenizer.position;
+  while (position < tokenizer.end && token_is_space(*position)) {
+    position++;
+  }
+  if (position == tokenizer.end) {
+    return {TOKEN_END, {}, 0};
+  }
+
+  const char *start = position;
+  switch (*position) {
+    case ',':
+      return {TOKEN_COMMA, {position++, 1}, 0};
+    case '(':
+      return {TOKEN_LEFT_PAREN, {position++, 1}, 0};
+    case ')':
+      return {TOKEN_RIGHT_PAREN, {position++, 1}, 0};
+    case '=':
+      return {TOKEN_EQUALS, {position++, 1}, 0};
+    case '\'': {
+      while (++position < tokenizer.end && *position != '\'') {
+      }
+      if (position == tokenizer.end) {
+        return {TOKEN_INVALID, {start, static_cast<size_t>(position - start)},
+                0};
+      }
+      position++;
+      return {TOKEN_STRING,
+              {start + 1, static_cast<size_t>(position - start - 2)}, 0};
+    }
+    default:
+      break;
+  }
+
+  uint64_t number = 0;
+  bool is_number = true;
+  while (position < tokenizer.end && !token_ends_word(*position)) {
+    auto digit = static_cast<uint64_t>(*position - '0');
+    is_number = is_number && digit <= 9
+        && number <= (UINT64_MAX - digit) / 10;
+    number = number * 10 + digit;
+    position++;
+  }
+  return {is_number ? TOKEN_NUMBER : TOKEN_WORD,
+          {start, static_cast<size_t>(position - start)},
+          is_number ? number : 0};
+}
+
+/*
+ * The syntax tree. Lists are linked through next, in the order written.
+ * */
+enum AstStatementType {
+  AST_INSERT,
+  AST_UPDATE,
+  AST_SELECT,
+  AST_CREATE_INDEX
+};
+
+struct AstLiteral {
+  TokenType type; // TOKEN_WORD, TOKEN_NUMBER or TOKEN_STRING.
+  std::string_view text;
+  uint64_t number;
+  AstLiteral *next;
+};
+
+struct AstAssignment {
+  std::string_view column;
+  AstLiteral *value;
+  AstAssignment *next;
+};
+
+// A column, or a call when is_call is set: name(argument).
+struct AstSelectItem {
+  std::string_view name;
+  bool is_call;
+  std::string_view argument;
+  AstSelectItem *next;
+};
+
+enum AstPredicateOp {
+  AST_PREDICATE_EQUALS,
+  AST_PREDICATE_LIKE,
+  AST_PREDICATE_CONTAINS,
+  AST_PREDICATE_BETWEEN
+};
+
+struct AstPredicate {
+  std::string_view column;
+  AstPredicateOp op;
+  AstLiteral *value; // the low bound for between.
+  AstLiteral *high;
+};
+
+enum AstOrder {
+  AST_ORDER_DEFAULT,
+  AST_ORDER_ASC,
+  AST_ORDER_DESC
+};
+
+struct AstStatement {
+  AstStatementType type;
+  AstLiteral *values; // insert.
+  AstAssignment *assignments; // update.
+  AstPredicate *where; // update and select, null without one.
+  // The rest are select's, but index_column.
+  bool unordered;
+  bool distinct;
+  AstSelectItem *items; // null for all the columns.
+  std::string_view group_by; // empty without one.
+  std::string_view order_by;
+  AstOrder order;
+  AstLiteral *limit;
+  AstLiteral *offset;
+  std::string_view index_column;
+};
+
+struct Parser {
+  Tokenizer tokenizer;
+  Token token; // the next token, not yet taken.
+  Arena *arena;
+};
+
+void parser_advance(Parser &parser) {
+  parser.token = tokenizer_next(parser.tokenizer);
+}
+
+/*
+ * Whether name is keyword, which is in lower case, ignoring name's case.
+ * */
+bool name_is(std::string_view name, std::string_view keyword) {
+  if (name.size() != keyword.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < keyword.size(); i++) {
+    char c = name[i];
+    if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != keyword[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool token_is_keyword(const Token &token, std::string_view keyword) {
+  return token.type == TOKEN_WORD && name_is(token.text, keyword);
+}
+
+/*
+ * Take the next token when it is keyword, or of type.
+ * */
+bool parser_accept_keyword(Parser &parser, std::string_view keyword) {
+  if (!token_is_keyword(parser.token, keyword)) {
+    return false;
+  }
+  parser_advance(parser);
+  return true;
+}
+
+bool parser_accept(Parser &parser, TokenType type) {
+  if (parser.token.type != type) {
+    return false;
+  }
+  parser_advance(parser);
+  return true;
+}
+
+/*
+ * Take a word into name. Numbers are not names.
+ * */
+bool parser_name(Parser &parser, std::string_view *name) {
+  if (parser.token.type != TOKEN_WORD) {
+    return false;
+  }
+  *name = parser.token.text;
+  parser_advance(parser);
+  return true;
+}
+
+AstLiteral *parser_literal(Parser &parser) {
+  if (parser.token.type != TOKEN_WORD && parser.token.type != TOKEN_NUMBER
+      && parser.token.type != TOKEN_STRING) {
+    return nullptr;
+  }
+  auto *literal = arena_new<AstLiteral>(*parser.arena);
+  literal->type = parser.token.type;
+  literal->text = parser.token.text;
+  literal->number = parser.token.number;
+  parser_advance(parser);
+  return literal;
+}
+
+bool parse_where(Parser &parser, AstPredicate **where) {
+  auto *predicate = arena_new<AstPredicate>(*parser.arena);
+  if (!parser_name(parser, &predicate->column)) {
+    return false;
+  }
+
+  if (parser_accept(parser, TOKEN_EQUALS)) {
+    predicate->op = AST_PREDICATE_EQUALS;
+  } else if (parser_accept_keyword(parser, "like")) {
+    predicate->op = AST_PREDICATE_LIKE;
+  } else if (parser_accept_keyword(parser, "contains")) {
+    predicate->op = AST_PREDICATE_CONTAINS;
+  } else if (parser_accept_keyword(parser, "between")) {
+    predicate->op = AST_PREDICATE_BETWEEN;
+    if ((predicate->value = parser_literal(parser)) == nullptr
+        || !parser_accept_keyword(parser, "and")) {
+      return false;
+    }
+    predicate->high = parser_literal(parser);
+    *where = predicate;
+    return predicate->high != nullptr;
+  } else {
+    return false;
+  }
+
+  predicate->value = parser_literal(parser);
+  *where = predicate;
+  return predicate->value != nullptr;
+}
+
+bool parse_insert(Parser &parser, AstStatement *statement) {
+  AstLiteral **tail = &statement->values;
+  for (int i = 0; i < 3; i++) {
+    if ((*tail = parser_literal(parser)) == nullptr) {
+      return false;
+    }
+    tail = &(*tail)->next;
+  }
+  return true;
+}
+
+bool parse_update(Parser &parser, AstStatement *statement) {
+  if (!parser_accept_keyword(parser, "set")) {
+    return false;
+  }
+
+  AstAssignment **tail = &statement->assignments;
+  do {
+    auto *assignment = arena_new<AstAssignment>(*parser.arena);
+    if (!parser_name(parser, &assignment->column)
+        || !parser_accept(parser, TOKEN_EQUALS)
+        || (assignment->value = parser_literal(parser)) == nullptr) {
+      return false;
+    }
+    *tail = assignment;
+    tail = &assignment->next;
+  } while (parser_accept(parser, TOKEN_COMMA));
+
+  return parser_accept_keyword(parser, "where")
+      && parse_where(parser, &statement->where);
+}
+
+/*
+ * Whether the next token starts the clauses after the select list.
+ * */
+bool parser_at_select_clause(const Parser &parser) {
+  return parser.token.type == TOKEN_END
+      || token_is_keyword(parser.token, "where")
+      || token_is_keyword(parser.token, "group")
+      || token_is_keyword(parser.token, "order")
+      || token_is_keyword(parser.token, "limit");
+}
+
+bool parse_select_items(Parser &parser, AstStatement *statement) {
+  if (parser_accept_keyword(parser, "distinct")) {
+    statement->distinct = true;
+    statement->items = arena_new<AstSelectItem>(*parser.arena);
+    return parser_name(parser, &statement->items->name);
+  }
+
+  AstSelectItem **tail = &statement->items;
+  do {
+    auto *item = arena_new<AstSelectItem>(*parser.arena);
+    if (!parser_name(parser, &item->name)) {
+      return false;
+    }
+    if (parser_accept(parser, TOKEN_LEFT_PAREN)) {
+      item->is_call = true;
+      if (parser.token.type != TOKEN_WORD
+          && parser.token.type != TOKEN_NUMBER) {
+        return false;
+      }
+      item->argument = parser.token.text;
+      parser_advance(parser);
+      if (!parser_accept(parser, TOKEN_RIGHT_PAREN)) {
+        return false;
+      }
+    }
+    *tail = item;
+    tail = &item->next;
+  } while (parser_accept(parser, TOKEN_COMMA));
+  return true;
+}
+
+bool parse_select(Parser &parser, AstStatement *statement) {
+  statement->unordered = parser_accept_keyword(parser, "unordered");
+  if (!parser_at_select_clause(parser)
+      && !parse_select_items(parser, statement)) {
+    return false;
+  }
+
+  if (parser_accept_keyword(parser, "where")
+      && !parse_where(parser, &statement->where)) {
+    return false;
+  }
+  if (parser_accept_keyword(parser, "group")
+      && !(parser_accept_keyword(parser, "by")
+          && parser_name(parser, &statement->group_by))) {
+    return false;
+  }
+  if (parser_accept_keyword(parser, "order")) {
+    if (!(parser_accept_keyword(parser, "by")
+        && parser_name(parser, &statement->order_by))) {
+      return false;
+    }
+    if (parser_accept_keyword(parser, "asc")) {
+      statement->order = AST_ORDER_ASC;
+    } else if (parser_accept_keyword(parser, "desc")) {
+      statement->order = AST_ORDER_DESC;
+    }
+  }
+  if (parser_accept_keyword(parser, "limit")) {
+    if ((statement->limit = parser_literal(parser)) == nullptr) {
+      return false;
+    }
+    if (parser_accept_keyword(parser, "offset")
+        && (statement->offset = parser_literal(parser)) == nullptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool parse_create(Parser &parser, AstStatement *statement) {
+  return parser_accept_keyword(parser, "index")
+      && parser_accept_keyword(parser, "on")
+      && parser_name(parser, &statement->index_column);
+}
+
+/*
+ * Parse input into a tree allocated in arena. PREPARE_UNRECOGNIZED_STATEMENT
+ * when input does not start with a statement's keyword, PREPARE_SYNTAX_ERROR
+ * when the rest does not follow the grammar or there is more after it.
+ * */
+PrepareResult parse_statement(std::string_view input,
+                              Arena &arena,
+                              AstStatement **result) {
+  Parser parser{{input.data(), input.data() + input.size()}, {}, &arena};
+  parser_advance(parser);
+
+  auto *statement = arena_new<AstStatement>(arena);
+  bool parsed;
+  if (parser_accept_keyword(parser, "insert")) {
+    statement->type = AST_INSERT;
+    parsed = parse_insert(parser, statement);
+  } else if (parser_accept_keyword(parser, "update")) {
+    statement->type = AST_UPDATE;
+    parsed = parse_update(parser, statement);
+  } else if (parser_accept_keyword(parser, "select")) {
+    statement->type = AST_SELECT;
+    parsed = parse_select(parser, statement);
+  } else if (parser_accept_keyword(parser, "create")) {
+    statement->type = AST_CREATE_INDEX;
+    parsed = parse_create(parser, statement);
+  } else {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  if (!parsed || parser.token.type != TOKEN_END) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  *result = statement;
+  return PREPARE_SUCCESS;
+}
+
+#endif //RK_SQLLITE_PARSER_H
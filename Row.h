@@ -5,14 +5,27 @@
 #ifndef RK_SQLLITE_ROW_H
 #define RK_SQLLITE_ROW_H
 
+#include <algorithm>
 #include <cstring>
+#include <iostream>
+#include <string_view>
+#include "Overflow.h"
 #include "Pager.h"
 
 #define COLUMN_USERNAME_SIZE 32
+// The longest email is a build option (-DCOLUMN_EMAIL_SIZE=...); its tail
+// past EMAIL_INLINE_SIZE goes to an overflow chain of any length.
+#ifndef COLUMN_EMAIL_SIZE
 #define COLUMN_EMAIL_SIZE 255
+#endif
+
+/*
+ * Type of Row::id, which is also the key of the table tree.
+ * */
+using TableKey = uint64_t;
 
 struct Row {
-  uint32_t id;
+  TableKey id;
   char username[COLUMN_USERNAME_SIZE];
   char email[COLUMN_EMAIL_SIZE];
 };
@@ -25,21 +38,64 @@ const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
 const uint32_t ID_OFFSET = 0;
 const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
 const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+
+/*
+ * A serialized row keeps at most EMAIL_INLINE_SIZE bytes of the email. The
+ * rest of a longer one goes to overflow slots, so a long email takes no
+ * more room in the leaf than a short one.
+ *   id | username | email prefix | email length | overflow slot
+ * */
+const uint32_t EMAIL_INLINE_SIZE = 64;
+const uint32_t EMAIL_LENGTH_SIZE = sizeof(uint32_t);
+const uint32_t EMAIL_LENGTH_OFFSET = EMAIL_OFFSET + EMAIL_INLINE_SIZE;
+const uint32_t EMAIL_OVERFLOW_SLOT_SIZE = sizeof(uint32_t);
+const uint32_t EMAIL_OVERFLOW_SLOT_OFFSET =
+    EMAIL_LENGTH_OFFSET + EMAIL_LENGTH_SIZE;
+const uint32_t ROW_SIZE = EMAIL_OVERFLOW_SLOT_OFFSET + EMAIL_OVERFLOW_SLOT_SIZE;
 
 const uint32_t ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
 const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
 
-void serialize_row(Row &source, std::byte *destination) {
+uint32_t *row_email_length(std::byte *row) {
+  return reinterpret_cast<uint32_t *>(row + EMAIL_LENGTH_OFFSET);
+}
+
+uint32_t *row_overflow_slot(std::byte *row) {
+  return reinterpret_cast<uint32_t *>(row + EMAIL_OVERFLOW_SLOT_OFFSET);
+}
+
+/*
+ * overflow_slot is the slot the row at destination already has, so
+ * overwriting a row reuses it; 0 for a new row.
+ * */
+void serialize_row(Row &source,
+                   std::byte *destination,
+                   Pager *pager,
+                   uint32_t overflow_slot) {
+  uint32_t email_length = strnlen(source.email, EMAIL_SIZE);
+  uint32_t inline_length = std::min(email_length, EMAIL_INLINE_SIZE);
+
   memcpy(destination + ID_OFFSET, &(source.id), ID_SIZE);
   memcpy(destination + USERNAME_OFFSET, &(source.username), USERNAME_SIZE);
-  memcpy(destination + EMAIL_OFFSET, &(source.email), EMAIL_SIZE);
+  memset(destination + EMAIL_OFFSET, 0, EMAIL_INLINE_SIZE);
+  memcpy(destination + EMAIL_OFFSET, &(source.email), inline_length);
+  *row_email_length(destination) = email_length;
+  *row_overflow_slot(destination) =
+      overflow_write(pager, source.email + inline_length,
+                     email_length - inline_length, overflow_slot);
 }
 
-void deserialize_row(std::byte *source, Row &destination) {
+void deserialize_row(std::byte *source, Row &destination, Pager *pager) {
+  uint32_t email_length = std::min(*row_email_length(source), EMAIL_SIZE);
+  uint32_t inline_length = std::min(email_length, EMAIL_INLINE_SIZE);
+
   memcpy(&(destination.id), source + ID_OFFSET, ID_SIZE);
   memcpy(&(destination.username), source + USERNAME_OFFSET, USERNAME_SIZE);
-  memcpy(&(destination.email), source + EMAIL_OFFSET, EMAIL_SIZE);
+  memset(&(destination.email), 0, EMAIL_SIZE);
+  memcpy(&(destination.email), source + EMAIL_OFFSET, inline_length);
+  overflow_read(pager, *row_overflow_slot(source),
+                destination.email + inline_length,
+                email_length - inline_length);
 }
 
 void print_row(const Row &row) {
@@ -47,4 +103,113 @@ void print_row(const Row &row) {
             << std::endl;
 }
 
+/*
+ * A serialized row read where it lies, without copying it into a Row.
+ * Pages stay in the pager until it is closed, so a view is good for as
+ * long as the pager is, but a writer may change the bytes under it: use it
+ * where rows are not being written, and table_lookup where they may be.
+ * */
+struct RowView {
+  const std::byte *bytes;
+  Pager *pager; // reads the part of a long email in its overflow slots.
+};
+
+RowView row_view(const std::byte *row, Pager *pager) {
+  return {row, pager};
+}
+
+TableKey row_view_id(const RowView &view) {
+  TableKey id;
+  memcpy(&id, view.bytes + ID_OFFSET, ID_SIZE);
+  return id;
+}
+
+std::string_view row_view_username(const RowView &view) {
+  const char *username =
+      reinterpret_cast<const char *>(view.bytes + USERNAME_OFFSET);
+  return {username, strnlen(username, USERNAME_SIZE)};
+}
+
+uint32_t row_view_email_length(const RowView &view) {
+  uint32_t length;
+  memcpy(&length, view.bytes + EMAIL_LENGTH_OFFSET, EMAIL_LENGTH_SIZE);
+  return std::min(length, EMAIL_SIZE);
+}
+
+/*
+ * The part of the email stored in the row itself: all of it unless the
+ * email is longer than EMAIL_INLINE_SIZE.
+ * */
+std::string_view row_view_email_inline(const RowView &view) {
+  return {reinterpret_cast<const char *>(view.bytes + EMAIL_OFFSET),
+          std::min(row_view_email_length(view), EMAIL_INLINE_SIZE)};
+}
+
+uint32_t row_view_overflow_slot(const RowView &view) {
+  uint32_t slot;
+  memcpy(&slot, view.bytes + EMAIL_OVERFLOW_SLOT_OFFSET,
+         EMAIL_OVERFLOW_SLOT_SIZE);
+  return slot;
+}
+
+/*
+ * The whole email. Read where it lies when it fits in the row; a longer one
+ * is put together in buffer, which needs room for EMAIL_SIZE bytes.
+ * */
+std::string_view row_view_email(const RowView &view, char *buffer) {
+  uint32_t length = row_view_email_length(view);
+  std::string_view inline_part = row_view_email_inline(view);
+  if (length == inline_part.size()) {
+    return inline_part;
+  }
+  memcpy(buffer, inline_part.data(), inline_part.size());
+  overflow_read(view.pager, row_view_overflow_slot(view),
+                buffer + inline_part.size(), length - inline_part.size());
+  return {buffer, length};
+}
+
+/*
+ * What deserialize_row gives, for a row that is only read.
+ * */
+void row_view_copy(const RowView &view, Row &row) {
+  std::string_view username = row_view_username(view);
+  row.id = row_view_id(view);
+  memset(row.username, 0, USERNAME_SIZE);
+  memcpy(row.username, username.data(), username.size());
+  std::string_view email = row_view_email_inline(view);
+  memset(row.email, 0, EMAIL_SIZE);
+  memcpy(row.email, email.data(), email.size());
+  overflow_read(view.pager, row_view_overflow_slot(view),
+                row.email + email.size(),
+                row_view_email_length(view) - email.size());
+}
+
+/*
+ * Compares the inline part first, so overflow slots are only read for
+ * emails that match up to there.
+ * */
+bool row_view_email_equals(const RowView &view, std::string_view value) {
+  uint32_t length = row_view_email_length(view);
+  std::string_view inline_part = row_view_email_inline(view);
+  if (value.size() != length
+      || value.compare(0, inline_part.size(), inline_part) != 0) {
+    return false;
+  }
+  return overflow_equals(view.pager, row_view_overflow_slot(view),
+                         value.data() + inline_part.size(),
+                         length - inline_part.size());
+}
+
+/*
+ * Same output as print_row.
+ * */
+void print_row_view(const RowView &view, std::ostream &out = std::cout) {
+  std::string_view email = row_view_email_inline(view);
+  out << "(" << row_view_id(view) << ", " << row_view_username(view)
+      << ", " << email;
+  overflow_print(out, view.pager, row_view_overflow_slot(view),
+                 row_view_email_length(view) - email.size());
+  out << ")" << std::endl;
+}
+
 #endif //RK_SQLLITE_ROW_H
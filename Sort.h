@@ -0,0 +1,248 @@
+#ifndef RK_SQLLITE_SORT_H
+#define RK_SQLLITE_SORT_H
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <vector>
+#include "Index.h"
+#include "Pager.h"
+#include "Row.h"
+
+/*
+ * ORDER BY on the username or email column, ties broken by id.
+ *
+ * Rows are collected in memory and sorted there when they fit in the
+ * memory budget. Past it, the rows collected so far are sorted and
+ * written out to temp pages as a run, and collecting starts over; at the
+ * end the runs are merged, one page of each in memory at a time.
+ *
+ * With a limit that fits in the budget only the best limit rows are kept,
+ * in a heap with the worst of them on top, so a row that does not make the
+ * cut costs one compare.
+ * */
+const uint32_t SORT_PAGE_USED_SIZE = sizeof(uint32_t);
+// A run record: id | username length | email length | username | email.
+const uint32_t SORT_RECORD_LENGTH_SIZE = sizeof(uint16_t);
+const uint32_t SORT_RECORD_HEADER_SIZE = ID_SIZE + 2 * SORT_RECORD_LENGTH_SIZE;
+static_assert(SORT_RECORD_HEADER_SIZE + USERNAME_SIZE + EMAIL_SIZE
+                  <= PAGE_SIZE - SORT_PAGE_USED_SIZE,
+              "a run record has to fit in a temp page");
+
+struct SortRun {
+  std::vector<uint32_t> temp_page_nums;
+};
+
+struct Sorter {
+  Pager *pager;
+  size_t memory_budget;
+  IndexColumn column;
+  uint32_t limit; // rows wanted, all of them when UINT32_MAX.
+  bool keeps_top; // rows is a heap of the best limit rows.
+  std::vector<Row> rows;
+  std::vector<SortRun> runs;
+};
+
+bool sort_less(const Row &a, const Row &b, IndexColumn column) {
+  int compare = column == INDEX_COLUMN_USERNAME
+                ? strncmp(a.username, b.username, USERNAME_SIZE)
+                : strncmp(a.email, b.email, EMAIL_SIZE);
+  return compare < 0 || (compare == 0 && a.id < b.id);
+}
+
+void sorter_init(Sorter &sorter,
+                 Pager *pager,
+                 size_t memory_budget,
+                 IndexColumn column,
+                 uint32_t limit) {
+  sorter.pager = pager;
+  sorter.memory_budget = memory_budget;
+  sorter.column = column;
+  sorter.limit = limit;
+  sorter.keeps_top = static_cast<uint64_t>(limit) * sizeof(Row)
+      <= memory_budget;
+  sorter.rows.clear();
+  sorter.runs.clear();
+}
+
+/*
+ * Append row to the run being written, starting a new page of it when
+ * page is full.
+ * */
+void sorter_write_record(Sorter &sorter,
+                         SortRun &run,
+                         std::byte *page,
+                         uint32_t &used,
+                         const Row &row) {
+  auto username_length =
+      static_cast<uint16_t>(strnlen(row.username, USERNAME_SIZE));
+  auto email_length = static_cast<uint16_t>(strnlen(row.email, EMAIL_SIZE));
+  uint32_t record_size =
+      SORT_RECORD_HEADER_SIZE + username_length + email_length;
+  if (used + record_size > PAGE_SIZE) {
+    memcpy(page, &used, SORT_PAGE_USED_SIZE);
+    run.temp_page_nums.push_back(sorter.pager->write_temp_page(page));
+    used = SORT_PAGE_USED_SIZE;
+  }
+
+  std::byte *record = page + used;
+  memcpy(record, &row.id, ID_SIZE);
+  memcpy(record + ID_SIZE, &username_length, SORT_RECORD_LENGTH_SIZE);
+  memcpy(record + ID_SIZE + SORT_RECORD_LENGTH_SIZE, &email_length,
+         SORT_RECORD_LENGTH_SIZE);
+  memcpy(record + SORT_RECORD_HEADER_SIZE, row.username, username_length);
+  memcpy(record + SORT_RECORD_HEADER_SIZE + username_length, row.email,
+         email_length);
+  used += record_size;
+}
+
+/*
+ * Sort the rows in memory and write them out as a new run.
+ * */
+void sorter_spill(Sorter &sorter) {
+  std::vector<const Row *> order;
+  order.reserve(sorter.rows.size());
+  for (const Row &row: sorter.rows) {
+    order.push_back(&row);
+  }
+  std::sort(order.begin(), order.end(), [&](const Row *a, const Row *b) {
+    return sort_less(*a, *b, sorter.column);
+  });
+
+  SortRun &run = sorter.runs.emplace_back();
+  std::byte page[PAGE_SIZE];
+  uint32_t used = SORT_PAGE_USED_SIZE;
+  for (const Row *row: order) {
+    sorter_write_record(sorter, run, page, used, *row);
+  }
+  memcpy(page, &used, SORT_PAGE_USED_SIZE);
+  run.temp_page_nums.push_back(sorter.pager->write_temp_page(page));
+  sorter.rows.clear();
+}
+
+void sorter_add(Sorter &sorter, const Row &row) {
+  auto less = [&](const Row &a, const Row &b) {
+    return sort_less(a, b, sorter.column);
+  };
+
+  if (sorter.keeps_top) {
+    if (sorter.rows.size() < sorter.limit) {
+      sorter.rows.push_back(row);
+      std::push_heap(sorter.rows.begin(), sorter.rows.end(), less);
+    } else if (sorter.limit > 0 && less(row, sorter.rows.front())) {
+      std::pop_heap(sorter.rows.begin(), sorter.rows.end(), less);
+      sorter.rows.back() = row;
+      std::push_heap(sorter.rows.begin(), sorter.rows.end(), less);
+    }
+    return;
+  }
+
+  sorter.rows.push_back(row);
+  if (sorter.rows.size() * (sizeof(Row) + sizeof(const Row *))
+      > sorter.memory_budget) {
+    sorter_spill(sorter);
+  }
+}
+
+/*
+ * Reads one run back a page at a time.
+ * */
+struct SortRunReader {
+  const SortRun *run;
+  uint32_t page_index;
+  std::byte page[PAGE_SIZE];
+  uint32_t used;
+  uint32_t offset;
+  Row row; // the record at the front of the run.
+};
+
+/*
+ * Move reader on to the run's next record. False at the end of the run.
+ * */
+bool sort_run_reader_next(Pager *pager, SortRunReader &reader) {
+  while (reader.offset >= reader.used) {
+    if (reader.page_index == reader.run->temp_page_nums.size()) {
+      return false;
+    }
+    pager->read_temp_page(reader.run->temp_page_nums[reader.page_index++],
+                          reader.page);
+    memcpy(&reader.used, reader.page, SORT_PAGE_USED_SIZE);
+    reader.offset = SORT_PAGE_USED_SIZE;
+  }
+
+  const std::byte *record = reader.page + reader.offset;
+  uint16_t username_length;
+  uint16_t email_length;
+  memcpy(&reader.row.id, record, ID_SIZE);
+  memcpy(&username_length, record + ID_SIZE, SORT_RECORD_LENGTH_SIZE);
+  memcpy(&email_length, record + ID_SIZE + SORT_RECORD_LENGTH_SIZE,
+         SORT_RECORD_LENGTH_SIZE);
+  memset(reader.row.username, 0, USERNAME_SIZE);
+  memcpy(reader.row.username, record + SORT_RECORD_HEADER_SIZE,
+         username_length);
+  memset(reader.row.email, 0, EMAIL_SIZE);
+  memcpy(reader.row.email,
+         record + SORT_RECORD_HEADER_SIZE + username_length, email_length);
+  reader.offset += SORT_RECORD_HEADER_SIZE + username_length + email_length;
+  return true;
+}
+
+/*
+ * Call emit(row) for the first limit rows in order, then drop the temp
+ * pages the runs took.
+ * */
+template<typename Emit>
+void sorter_finish(Sorter &sorter, Emit emit) {
+  auto less = [&](const Row &a, const Row &b) {
+    return sort_less(a, b, sorter.column);
+  };
+
+  if (sorter.runs.empty()) {
+    if (sorter.keeps_top) {
+      std::sort_heap(sorter.rows.begin(), sorter.rows.end(), less);
+    } else {
+      std::sort(sorter.rows.begin(), sorter.rows.end(), less);
+    }
+    uint32_t count = std::min<size_t>(sorter.limit, sorter.rows.size());
+    for (uint32_t i = 0; i < count; i++) {
+      emit(sorter.rows[i]);
+    }
+    sorter.rows.clear();
+    return;
+  }
+
+  if (!sorter.rows.empty()) {
+    sorter_spill(sorter);
+  }
+
+  // A heap of the readers, the one whose front row comes first on top.
+  std::vector<SortRunReader> readers(sorter.runs.size());
+  auto reader_after = [&](uint32_t a, uint32_t b) {
+    return less(readers[b].row, readers[a].row);
+  };
+  std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(reader_after)>
+      heap(reader_after);
+  for (uint32_t i = 0; i < readers.size(); i++) {
+    readers[i].run = &sorter.runs[i];
+    readers[i].page_index = 0;
+    readers[i].used = 0;
+    readers[i].offset = 0;
+    if (sort_run_reader_next(sorter.pager, readers[i])) {
+      heap.push(i);
+    }
+  }
+
+  for (uint32_t count = 0; count < sorter.limit && !heap.empty(); count++) {
+    uint32_t next = heap.top();
+    heap.pop();
+    emit(readers[next].row);
+    if (sort_run_reader_next(sorter.pager, readers[next])) {
+      heap.push(next);
+    }
+  }
+
+  sorter.runs.clear();
+  sorter.pager->release_temp_pages();
+}
+
+#endif //RK_SQLLITE_SORT_H
@@ -0,0 +1,203 @@
+#ifndef RK_SQLLITE_STRINGMATCH_H
+#define RK_SQLLITE_STRINGMATCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "Row.h"
+
+/*
+ * String predicates on the username and email columns, evaluated on the
+ * bytes of the serialized row.
+ *
+ * Compares go 16 bytes at a time: one vector compare gives a bit per byte,
+ * and masking that to the bytes that matter replaces a loop with a branch
+ * per character. Without SSE2 the same masks are built a byte at a time.
+ * */
+constexpr uint32_t SIMD_WIDTH = 16;
+
+enum StringMatch {
+  STRING_MATCH_EQUALS,
+  STRING_MATCH_PREFIX,
+  STRING_MATCH_CONTAINS
+};
+
+// Room for the longest email and its terminator, rounded up to whole
+// vectors, and a full vector past that.
+constexpr uint32_t STRING_PATTERN_CAPACITY =
+    (COLUMN_EMAIL_SIZE + SIMD_WIDTH) / SIMD_WIDTH * SIMD_WIDTH + SIMD_WIDTH;
+
+struct StringPattern {
+  StringMatch match;
+  uint32_t length;
+  // The value, zero padded so a vector load anywhere in it stays inside.
+  alignas(SIMD_WIDTH) char bytes[STRING_PATTERN_CAPACITY];
+};
+
+StringPattern string_pattern(StringMatch match, std::string_view value) {
+  StringPattern pattern{};
+  pattern.match = match;
+  pattern.length = std::min<uint32_t>(value.size(),
+                                      STRING_PATTERN_CAPACITY - 1);
+  memcpy(pattern.bytes, value.data(), pattern.length);
+  return pattern;
+}
+
+/*
+ * Bit i set where a[i] == b[i], over the 16 bytes at a and b.
+ * */
+uint32_t simd_equal_mask(const char *a, const char *b) {
+#if defined(__SSE2__)
+  __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+  __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(left, right));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < SIMD_WIDTH; i++) {
+    mask |= static_cast<uint32_t>(a[i] == b[i]) << i;
+  }
+  return mask;
+#endif
+}
+
+/*
+ * Bit i set where a[i] == c, over the 16 bytes at a.
+ * */
+uint32_t simd_byte_mask(const char *a, char c) {
+#if defined(__SSE2__)
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < SIMD_WIDTH; i++) {
+    mask |= static_cast<uint32_t>(a[i] == c) << i;
+  }
+  return mask;
+#endif
+}
+
+/*
+ * Mask of the lowest count bits of a vector mask, all 16 when count is
+ * past the vector.
+ * */
+uint32_t simd_low_bits(uint32_t count) {
+  return count >= SIMD_WIDTH ? 0xFFFF : (1u << count) - 1;
+}
+
+/*
+ * Whether the first length bytes at text are those of pattern. Reads whole
+ * vectors from both, so length rounded up to 16 bytes must be readable.
+ * */
+bool simd_starts_with(const char *text, const char *pattern, uint32_t length) {
+  for (uint32_t i = 0; i < length; i += SIMD_WIDTH) {
+    uint32_t wanted = simd_low_bits(length - i);
+    if ((simd_equal_mask(text + i, pattern + i) & wanted) != wanted) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Whether needle occurs in the length bytes at text.
+ *
+ * Compares the first and the last byte of needle against 16 candidate
+ * start positions at once and only checks the bytes between for the
+ * positions where both agree, which in text that is not mostly needle is
+ * few of them. Reads up to 16 bytes past text + length, which must be
+ * readable.
+ * */
+bool simd_contains(const char *text,
+                   uint32_t length,
+                   const char *needle,
+                   uint32_t needle_length) {
+  if (needle_length == 0) {
+    return true;
+  }
+  if (needle_length > length) {
+    return false;
+  }
+
+  uint32_t last = needle_length - 1;
+  uint32_t num_starts = length - last;
+  for (uint32_t i = 0; i < num_starts; i += SIMD_WIDTH) {
+    uint32_t candidates = simd_byte_mask(text + i, needle[0])
+        & simd_byte_mask(text + i + last, needle[last])
+        & simd_low_bits(num_starts - i);
+    while (candidates != 0) {
+      uint32_t start = i + __builtin_ctz(candidates);
+      if (last <= 1 || memcmp(text + start + 1, needle + 1, last - 1) == 0) {
+        return true;
+      }
+      candidates &= candidates - 1;
+    }
+  }
+  return false;
+}
+
+/*
+ * The username column is USERNAME_SIZE bytes, zero terminated when shorter,
+ * and may hold leftover bytes after the terminator.
+ * */
+bool row_view_username_matches(const RowView &view,
+                               const StringPattern &pattern) {
+  const char *username =
+      reinterpret_cast<const char *>(view.bytes + USERNAME_OFFSET);
+  switch (pattern.match) {
+    case STRING_MATCH_EQUALS:
+      // The pattern's terminator has to line up with the username's.
+      return pattern.length <= USERNAME_SIZE
+          && simd_starts_with(username, pattern.bytes,
+                              std::min(pattern.length + 1, USERNAME_SIZE));
+    case STRING_MATCH_PREFIX:
+      return pattern.length <= USERNAME_SIZE
+          && simd_starts_with(username, pattern.bytes, pattern.length);
+    case STRING_MATCH_CONTAINS:
+      // The rest of the row follows the username, so the vector reads
+      // past it stay in the row.
+      return simd_contains(username, strnlen(username, USERNAME_SIZE),
+                           pattern.bytes, pattern.length);
+  }
+  return false;
+}
+
+/*
+ * The inline part of the email is compared in the row; the overflow slot
+ * of a long email is only read when that part matches, or for contains,
+ * copied out to search the email in one piece.
+ * */
+bool row_view_email_matches(const RowView &view,
+                            const StringPattern &pattern) {
+  uint32_t length = row_view_email_length(view);
+  std::string_view inline_part = row_view_email_inline(view);
+
+  if (pattern.match == STRING_MATCH_CONTAINS) {
+    if (length == inline_part.size()) {
+      // Cells sit in front of the leaf's zone map, so reading a vector
+      // past the last row's email stays in the page.
+      return simd_contains(inline_part.data(), length,
+                           pattern.bytes, pattern.length);
+    }
+    alignas(SIMD_WIDTH) char email[STRING_PATTERN_CAPACITY]{};
+    memcpy(email, inline_part.data(), inline_part.size());
+    overflow_read(view.pager, row_view_overflow_slot(view),
+                  email + inline_part.size(), length - inline_part.size());
+    return simd_contains(email, length, pattern.bytes, pattern.length);
+  }
+
+  if (pattern.match == STRING_MATCH_EQUALS ? length != pattern.length
+                                           : length < pattern.length) {
+    return false;
+  }
+  uint32_t inline_length = std::min<uint32_t>(pattern.length,
+                                               inline_part.size());
+  return simd_starts_with(inline_part.data(), pattern.bytes, inline_length)
+      && overflow_equals(view.pager, row_view_overflow_slot(view),
+                         pattern.bytes + inline_length,
+                         pattern.length - inline_length);
+}
+
+#endif //RK_SQLLITE_STRINGMATCH_H
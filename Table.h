@@ -3,13 +3,113 @@
 //
 #include "Node.h"
 #include "Pager.h"
+#include "Index.h"
+#include "Latch.h"
+#include "Eytzinger.h"
 
 #ifndef RK_SQLLITE_TABLE_H
 #define RK_SQLLITE_TABLE_H
 
+/*
+ * Database header layout. Page 0 holds the root page numbers of the table
+ * tree and of every secondary index so they survive a restart, followed by
+ * table wide flags, the overflow page new slots are taken from and the
+ * pager's free pages.
+ * */
+constexpr uint32_t HEADER_PAGE_NUM = 0;
+constexpr uint32_t HEADER_ROOT_PAGE_NUM_OFFSET = 0;
+constexpr uint32_t HEADER_USERNAME_INDEX_ROOT_OFFSET =
+    HEADER_ROOT_PAGE_NUM_OFFSET + sizeof(uint32_t);
+constexpr uint32_t HEADER_EMAIL_INDEX_ROOT_OFFSET =
+    HEADER_USERNAME_INDEX_ROOT_OFFSET + sizeof(uint32_t);
+constexpr uint32_t HEADER_WRITE_BUFFERING_OFFSET =
+    HEADER_EMAIL_INDEX_ROOT_OFFSET + sizeof(uint32_t);
+constexpr uint32_t HEADER_OVERFLOW_PAGE_NUM_OFFSET =
+    HEADER_WRITE_BUFFERING_OFFSET + sizeof(uint32_t);
+constexpr uint32_t HEADER_NUM_FREE_PAGES_OFFSET =
+    HEADER_OVERFLOW_PAGE_NUM_OFFSET + sizeof(uint32_t);
+constexpr uint32_t HEADER_FREE_PAGES_OFFSET =
+    HEADER_NUM_FREE_PAGES_OFFSET + sizeof(uint32_t);
+static_assert(HEADER_FREE_PAGES_OFFSET + TABLE_MAX_PAGES * sizeof(uint32_t)
+                  <= PAGE_SIZE,
+              "Every page has to fit in the header's free list");
+
+uint32_t *header_root_page_num(std::byte *header) {
+  return reinterpret_cast<uint32_t *>(header + HEADER_ROOT_PAGE_NUM_OFFSET);
+}
+
+uint32_t *header_username_index_root(std::byte *header) {
+  return reinterpret_cast<uint32_t *>(header
+      + HEADER_USERNAME_INDEX_ROOT_OFFSET);
+}
+
+uint32_t *header_email_index_root(std::byte *header) {
+  return reinterpret_cast<uint32_t *>(header + HEADER_EMAIL_INDEX_ROOT_OFFSET);
+}
+
+uint32_t *header_write_buffering(std::byte *header) {
+  return reinterpret_cast<uint32_t *>(header + HEADER_WRITE_BUFFERING_OFFSET);
+}
+
+uint32_t *header_overflow_page_num(std::byte *header) {
+  return reinterpret_cast<uint32_t *>(header
+      + HEADER_OVERFLOW_PAGE_NUM_OFFSET);
+}
+
+uint32_t *header_num_free_pages(std::byte *header) {
+  return reinterpret_cast<uint32_t *>(header + HEADER_NUM_FREE_PAGES_OFFSET);
+}
+
+uint32_t *header_free_page(std::byte *header, uint32_t free_page_num) {
+  return reinterpret_cast<uint32_t *>(header + HEADER_FREE_PAGES_OFFSET)
+      + free_page_num;
+}
+
+/*
+ * Eytzinger ordered copy of the keys of one internal node, for lookups.
+ * Treated as part of the page: it is written only under the page's write
+ * latch and read within a reader's validated window. Dropped whenever the
+ * node's keys change and built again once lookups show the node is being
+ * read more than written.
+ * */
+struct InternalNodeSearch {
+  // Read by lookups before they validate the page, so atomic; set with
+  // release once index is built and read with acquire before using it.
+  std::atomic<bool> is_built;
+  // Lookups that found no index since it was last dropped.
+  std::atomic<uint32_t> misses;
+  EytzingerIndex<TableKey, INTERNAL_NODE_MAX_CELLS> index;
+};
+
+constexpr size_t DEFAULT_WORK_MEMORY = 4 * 1024 * 1024;
+// Below this a hash table would spill after nearly every new group.
+constexpr size_t MIN_WORK_MEMORY = 64 * 1024;
+
 struct Table {
   Pager *pager;
-  uint32_t root_page_num;
+  // Atomic since .compact moves the root to another page while lookups on
+  // other threads are reading it.
+  std::atomic<uint32_t> root_page_num;
+  // Rightmost leaf seen by the last descent, 0 when unknown. Only a hint:
+  // it is checked before use.
+  uint32_t rightmost_leaf_page_num;
+  Index username_index;
+  Index email_index;
+  // Inserts are parked in the root's write buffer and pushed down to the
+  // leaves in batches. Saved in the header since the root page layout
+  // depends on it.
+  bool write_buffering;
+  // Threads a full scan is split over, see table_parallel_scan. Not saved.
+  uint32_t scan_threads;
+  // Bytes a query's hash table may take before it spills to temp pages.
+  // Not saved.
+  size_t work_memory;
+  // Version latch of every table tree page, see table_lookup/table_insert.
+  PageLatch latches[TABLE_MAX_PAGES];
+  // Times table_lookup read a page that changed under it and started over.
+  std::atomic<uint64_t> lookup_restarts;
+  // Search index of every internal table tree page, see table_lookup.
+  InternalNodeSearch internal_search[TABLE_MAX_PAGES];
 };
 
 #endif //RK_SQLLITE_TABLE_H
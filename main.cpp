@@ -1,25 +1,73 @@
+#include <cinttypes>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <utility>
 #include "MetaCommandResult.h"
 #include "Table.h"
 #include "Cursor.h"
 #include "Row.h"
+#include "Batch.h"
+#include "Parallel.h"
+#include "Aggregate.h"
+#include "GroupBy.h"
+#include "Sort.h"
+#include "Parser.h"
 
 enum StatementType {
   STATEMENT_INSERT,
-  STATEMENT_SELECT
+  STATEMENT_SELECT,
+  STATEMENT_CREATE_INDEX,
+  STATEMENT_UPDATE
 };
 
 enum ExecuteResult {
   EXECUTE_SUCCESS,
   EXECUTE_DUPLICATE_KEY,
-  EXECUTE_TABLE_FULL
+  EXECUTE_TABLE_FULL,
+  EXECUTE_INDEX_EXISTS,
+  EXECUTE_COLUMN_TOO_WIDE
 };
 
 
+enum SelectFilter {
+  SELECT_ALL,
+  SELECT_ID_EQUALS,
+  SELECT_ID_BETWEEN,
+  SELECT_COLUMN_EQUALS,
+  SELECT_LIMIT
+};
+
 struct Statement {
   StatementType type;
-  Row row_to_insert; // only used by insert statement;
+  Row row_to_insert; // new row for insert, new column values for update.
+  bool set_username; // columns an update assigns.
+  bool set_email;
+  SelectFilter filter; // only used by select statement;
+  TableKey key_low; // inclusive bounds on id for the seek based filters.
+  TableKey key_high;
+  IndexColumn column; // column for create index and text filters.
+  char text_value[COLUMN_EMAIL_SIZE]; // value compared against column.
+  StringMatch match; // how text_value is compared.
+  uint32_t limit; // rows to return and rows to skip for limit/offset.
+  uint32_t offset;
+  bool unordered; // full scans may print rows as threads find them.
+  // Aggregates printed instead of the rows, in order; none for a plain
+  // select.
+  AggregateFunction aggregates[MAX_AGGREGATES];
+  uint32_t num_aggregates;
+  // Rows are grouped on group_column and one is printed per value, with
+  // its count when group_count is set.
+  bool grouped;
+  IndexColumn group_column;
+  bool group_count;
+  // Rows are printed in order of id when sort_by_key is set, of
+  // sort_column otherwise, at most limit of them when sort_limited is set.
+  bool sorted;
+  bool sort_by_key;
+  IndexColumn sort_column;
+  bool descending; // only for the order of id.
+  bool sort_limited;
 };
 
 struct InputBuffer {
@@ -43,14 +91,124 @@ std::string readInput() {
   return user_text;
 }
 
+/*
+ * Turning buffering off pushes everything buffered down first, since the
+ * root's cells may then grow into the buffer space.
+ * */
+MetaCommandResult set_write_buffering(Table *table, bool enable) {
+  std::byte *root = table->pager->get_page(table->root_page_num);
+  if (enable == table->write_buffering) {
+    return META_COMMAND_SUCCESS;
+  }
+
+  if (!enable) {
+    table_flush_buffer(table);
+    table->write_buffering = false;
+    return META_COMMAND_SUCCESS;
+  }
+
+  if (get_node_type(root) == NODE_INTERNAL) {
+    if (*internal_node_num_keys(root)
+        >= InternalNodeBufferLayout<TableKey>::MAX_CELLS) {
+      std::cout << "Root has too many children to make room for a buffer."
+                << std::endl;
+      return META_COMMAND_SUCCESS;
+    }
+    *internal_node_buffer_count(root) = 0;
+  }
+  table->write_buffering = true;
+  return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .compact [fill percent], 90 by default so the leaves have some room left
+ * for inserts before they split again.
+ * */
+MetaCommandResult compact_table(Table *table, const std::string &command) {
+  uint32_t fill_percent = 90;
+  int consumed = 0;
+  if (command != ".compact"
+      && !(sscanf(command.c_str(), ".compact %u %n", &fill_percent,
+                  &consumed) == 1
+          && consumed == static_cast<int>(command.size()))) {
+    return META_COMMAND_UNRECOGNIZED_COMMAND;
+  }
+
+  if (fill_percent < 1 || fill_percent > 100) {
+    std::cout << "Fill factor must be between 1 and 100." << std::endl;
+    return META_COMMAND_SUCCESS;
+  }
+
+  if (!table_compact(table, fill_percent)) {
+    std::cout << "Not enough free pages to compact the table." << std::endl;
+  }
+  return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .threads <count>, the number of threads full scans are split over.
+ * */
+MetaCommandResult set_scan_threads(Table *table, const std::string &command) {
+  uint32_t scan_threads = 0;
+  int consumed = 0;
+  if (!(sscanf(command.c_str(), ".threads %u %n", &scan_threads,
+               &consumed) == 1
+      && consumed == static_cast<int>(command.size()))) {
+    return META_COMMAND_UNRECOGNIZED_COMMAND;
+  }
+
+  if (scan_threads < 1) {
+    std::cout << "Need at least one scan thread." << std::endl;
+    return META_COMMAND_SUCCESS;
+  }
+
+  table->scan_threads = scan_threads;
+  return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .memory <kilobytes>, how much a query's hash table may take before it
+ * spills to temp pages.
+ * */
+MetaCommandResult set_work_memory(Table *table, const std::string &command) {
+  uint32_t kilobytes = 0;
+  int consumed = 0;
+  if (!(sscanf(command.c_str(), ".memory %u %n", &kilobytes, &consumed) == 1
+      && consumed == static_cast<int>(command.size()))) {
+    return META_COMMAND_UNRECOGNIZED_COMMAND;
+  }
+
+  if (kilobytes < MIN_WORK_MEMORY / 1024) {
+    std::cout << "Need at least " << MIN_WORK_MEMORY / 1024
+              << " kilobytes of work memory." << std::endl;
+    return META_COMMAND_SUCCESS;
+  }
+
+  table->work_memory = static_cast<size_t>(kilobytes) * 1024;
+  return META_COMMAND_SUCCESS;
+}
+
 MetaCommandResult do_meta_command(std::string &command, Table *table) {
   if (command == ".exit") {
     db_close(table);
     exit(EXIT_SUCCESS);
   } else if (command == ".btree") {
     std::cout << "Tree: " << std::endl;
-    print_leaf_node(table->pager->get_page(0));
+    print_tree(table->pager, table->root_page_num, 0);
+    std::byte *root = table->pager->get_page(table->root_page_num);
+    if (table_buffer_active(table, root)) {
+      std::cout << "- buffer (size " << *internal_node_buffer_count(root)
+                << ")" << std::endl;
+    }
     return META_COMMAND_SUCCESS;
+  } else if (command == ".buffer on" || command == ".buffer off") {
+    return set_write_buffering(table, command == ".buffer on");
+  } else if (command.compare(0, 8, ".compact") == 0) {
+    return compact_table(table, command);
+  } else if (command.compare(0, 8, ".threads") == 0) {
+    return set_scan_threads(table, command);
+  } else if (command.compare(0, 7, ".memory") == 0) {
+    return set_work_memory(table, command);
   } else if (command == ".constants") {
     std::cout << "Constants: " << std::endl;
     print_constants();
@@ -60,69 +218,814 @@ MetaCommandResult do_meta_command(std::string &command, Table *table) {
   }
 }
 
-PrepareResult
-prepare_statement(const std::string &user_input, Statement *statement) {
-  if (user_input.compare(0, 6, "insert") == 0) {
-    statement->type = STATEMENT_INSERT;
-    int args_assigned = sscanf(user_input.c_str(),
-                               "insert %d %s %s",
-        // We need to provide addresses here.
-                               &(statement->row_to_insert.id),
-        // Name of the array is the address of the first byte.
-                               statement->row_to_insert.username,
-                               statement->row_to_insert.email);
-
-    std::cout << "Printing Row: " << statement->row_to_insert.id << " "
-              << statement->row_to_insert.username << " "
-              << statement->row_to_insert.email << std::endl;
-
-    if (args_assigned < 3) {
+/*
+ * The string column called name.
+ * */
+bool prepare_column(std::string_view name, IndexColumn *column) {
+  if (name_is(name, "username")) {
+    *column = INDEX_COLUMN_USERNAME;
+  } else if (name_is(name, "email")) {
+    *column = INDEX_COLUMN_EMAIL;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Longest value a column holds, leaving room for the terminator.
+uint32_t column_max_length(IndexColumn column) {
+  return column == INDEX_COLUMN_USERNAME ? USERNAME_SIZE - 1 : EMAIL_SIZE - 1;
+}
+
+PrepareResult prepare_text(std::string_view text,
+                           char *destination,
+                           uint32_t max_length) {
+  if (text.size() > max_length) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  memcpy(destination, text.data(), text.size());
+  destination[text.size()] = '\0';
+  return PREPARE_SUCCESS;
+}
+
+bool prepare_count(const AstLiteral &literal, uint32_t *count) {
+  if (literal.type != TOKEN_NUMBER || literal.number > UINT32_MAX) {
+    return false;
+  }
+  *count = static_cast<uint32_t>(literal.number);
+  return true;
+}
+
+/*
+ * insert <id> <username> <email>
+ * */
+PrepareResult prepare_insert(const AstStatement &ast, Statement *statement) {
+  statement->type = STATEMENT_INSERT;
+  Row &row = statement->row_to_insert;
+  const AstLiteral *id = ast.values;
+  if (id->type != TOKEN_NUMBER) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  row.id = id->number;
+
+  PrepareResult result =
+      prepare_text(id->next->text, row.username, USERNAME_SIZE - 1);
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_text(id->next->next->text, row.email, EMAIL_SIZE - 1);
+  }
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+
+  std::cout << "Printing Row: " << row.id << " " << row.username << " "
+            << row.email << std::endl;
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * update set <username|email> = <value>[, ...] where id = <id>
+ * */
+PrepareResult prepare_update(const AstStatement &ast, Statement *statement) {
+  statement->type = STATEMENT_UPDATE;
+  Row &row = statement->row_to_insert;
+  for (const AstAssignment *assignment = ast.assignments;
+       assignment != nullptr; assignment = assignment->next) {
+    IndexColumn column;
+    if (!prepare_column(assignment->column, &column)) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    bool &assigned = column == INDEX_COLUMN_USERNAME
+                     ? statement->set_username : statement->set_email;
+    if (assigned) {
       return PREPARE_SYNTAX_ERROR;
     }
+    assigned = true;
+
+    PrepareResult result = prepare_text(
+        assignment->value->text,
+        column == INDEX_COLUMN_USERNAME ? row.username : row.email,
+        column_max_length(column));
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+  }
+
+  const AstPredicate &where = *ast.where;
+  if (!name_is(where.column, "id") || where.op != AST_PREDICATE_EQUALS
+      || where.value->type != TOKEN_NUMBER) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  statement->key_low = where.value->number;
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * count(*), min(id), max(id) or sum(id).
+ * */
+bool prepare_aggregate(const AstSelectItem &item,
+                       AggregateFunction *function) {
+  static const std::pair<std::string_view, AggregateFunction> names[] = {
+      {"count", AGGREGATE_COUNT},
+      {"min", AGGREGATE_MIN},
+      {"max", AGGREGATE_MAX},
+      {"sum", AGGREGATE_SUM}};
+
+  if (!item.is_call) {
+    return false;
+  }
+  for (const auto &[name, name_function]: names) {
+    if (name_is(item.name, name)) {
+      *function = name_function;
+      return item.argument
+          == (name_function == AGGREGATE_COUNT ? "*" : "id");
+    }
+  }
+  return false;
+}
 
+/*
+ * What a select prints instead of the rows: up to MAX_AGGREGATES
+ * aggregates, "distinct <column>", or "<column>, count(*)" with
+ * "group by <column>" on the same column.
+ * */
+PrepareResult prepare_select_items(const AstStatement &ast,
+                                   Statement *statement) {
+  const AstSelectItem *items = ast.items;
+  if (ast.distinct) {
+    statement->grouped = true;
+    statement->group_count = false;
+    return ast.group_by.empty()
+           && prepare_column(items->name, &(statement->group_column))
+           ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+  }
+
+  if (items != nullptr && !items->is_call) {
+    AggregateFunction function;
+    IndexColumn group_by;
+    if (items->next == nullptr || items->next->next != nullptr
+        || !prepare_aggregate(*items->next, &function)
+        || function != AGGREGATE_COUNT
+        || !prepare_column(items->name, &(statement->group_column))
+        || !prepare_column(ast.group_by, &group_by)
+        || group_by != statement->group_column) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->grouped = true;
+    statement->group_count = true;
     return PREPARE_SUCCESS;
   }
 
-  if (user_input.compare(0, 6, "select") == 0) {
-    statement->type = STATEMENT_SELECT;
+  if (!ast.group_by.empty()) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  for (const AstSelectItem *item = items; item != nullptr;
+       item = item->next) {
+    if (statement->num_aggregates == MAX_AGGREGATES
+        || !prepare_aggregate(
+            *item, &(statement->aggregates[statement->num_aggregates]))) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->num_aggregates++;
+  }
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * where id = <id>, where id between <low> and <high>, or
+ * where <username|email> <=|like|contains> <value>.
+ *
+ * The value is a single word, or quoted in single quotes to hold spaces.
+ * like takes a value ending in '%' as a prefix and one without wildcards
+ * as an exact value; '_' and '%' anywhere else are not supported.
+ * */
+PrepareResult prepare_where(const AstPredicate &where, Statement *statement) {
+  if (name_is(where.column, "id")) {
+    if (where.value->type != TOKEN_NUMBER) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->key_low = where.value->number;
+    if (where.op == AST_PREDICATE_EQUALS) {
+      statement->filter = SELECT_ID_EQUALS;
+      statement->key_high = statement->key_low;
+      return PREPARE_SUCCESS;
+    }
+    if (where.op == AST_PREDICATE_BETWEEN
+        && where.high->type == TOKEN_NUMBER) {
+      statement->filter = SELECT_ID_BETWEEN;
+      statement->key_high = where.high->number;
+      return PREPARE_SUCCESS;
+    }
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  if (!prepare_column(where.column, &(statement->column))) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  std::string_view value = where.value->text;
+  switch (where.op) {
+    case AST_PREDICATE_EQUALS:
+      statement->match = STRING_MATCH_EQUALS;
+      break;
+    case AST_PREDICATE_CONTAINS:
+      statement->match = STRING_MATCH_CONTAINS;
+      break;
+    case AST_PREDICATE_LIKE: {
+      size_t wildcard = value.find_first_of("%_");
+      if (wildcard == std::string_view::npos) {
+        statement->match = STRING_MATCH_EQUALS;
+      } else if (wildcard == value.size() - 1 && value.back() == '%') {
+        statement->match = STRING_MATCH_PREFIX;
+        value.remove_suffix(1);
+      } else {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      break;
+    }
+    case AST_PREDICATE_BETWEEN:
+      return PREPARE_SYNTAX_ERROR;
+  }
+
+  statement->filter = SELECT_COLUMN_EQUALS;
+  return prepare_text(value, statement->text_value,
+                      column_max_length(statement->column));
+}
+
+/*
+ * order by takes id, ascending or descending, or a string column
+ * ascending, and a limit; it does not go with aggregates or grouping.
+ * limit without order by pages through the table and takes an offset but
+ * no other clause.
+ * */
+PrepareResult prepare_select(const AstStatement &ast, Statement *statement) {
+  statement->type = STATEMENT_SELECT;
+  statement->filter = SELECT_ALL;
+  statement->unordered = ast.unordered;
+  PrepareResult result = prepare_select_items(ast, statement);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+
+  if (!ast.order_by.empty()) {
+    if (statement->grouped || statement->num_aggregates > 0
+        || ast.offset != nullptr) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->sorted = true;
+    if (name_is(ast.order_by, "id")) {
+      statement->sort_by_key = true;
+      statement->descending = ast.order == AST_ORDER_DESC;
+    } else if (!prepare_column(ast.order_by, &(statement->sort_column))
+        || ast.order == AST_ORDER_DESC) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    if (ast.limit != nullptr) {
+      if (!prepare_count(*ast.limit, &(statement->limit))) {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      statement->sort_limited = true;
+    }
+  } else if (ast.limit != nullptr) {
+    if (ast.items != nullptr || ast.where != nullptr
+        || !prepare_count(*ast.limit, &(statement->limit))
+        || (ast.offset != nullptr
+            && !prepare_count(*ast.offset, &(statement->offset)))) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->filter = SELECT_LIMIT;
     return PREPARE_SUCCESS;
   }
 
-  return PREPARE_UNRECOGNIZED_STATEMENT;
+  return ast.where == nullptr ? PREPARE_SUCCESS
+                              : prepare_where(*ast.where, statement);
 }
 
-ExecuteResult execute_select(Statement *statement, Table *table) {
-  Cursor *cursor = table_start(table);
+/*
+ * Parse input and fill statement in from the tree. The tree lives in arena
+ * until the next statement resets it, and nothing in statement points
+ * into it.
+ * */
+PrepareResult
+prepare_statement(const std::string &input, Statement *statement,
+                  Arena &arena) {
+  arena_reset(arena);
+  AstStatement *ast = nullptr;
+  PrepareResult result = parse_statement(input, arena, &ast);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+
+  switch (ast->type) {
+    case AST_INSERT:
+      return prepare_insert(*ast, statement);
+    case AST_UPDATE:
+      return prepare_update(*ast, statement);
+    case AST_SELECT:
+      return prepare_select(*ast, statement);
+    case AST_CREATE_INDEX:
+      statement->type = STATEMENT_CREATE_INDEX;
+      return prepare_column(ast->index_column, &(statement->column))
+             ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+  }
+  return PREPARE_SYNTAX_ERROR;
+}
+
+/*
+ * Leaves the rows the statement's where clause asks for are in, as
+ * partitions for select_batches. An id range is one partition from a seek
+ * to key_low; anything else may be anywhere in the table.
+ * */
+std::vector<ScanPartition> select_partitions(Statement *statement,
+                                             Table *table) {
+  if (statement->filter == SELECT_ID_EQUALS
+      || statement->filter == SELECT_ID_BETWEEN) {
+    if (statement->key_low > statement->key_high) {
+      return {};
+    }
+    return {{table_seek(table, statement->key_low), 0}};
+  }
+  return table_partition_leaves(table);
+}
+
+/*
+ * Call consume(partition_num, batch) for every batch of rows from
+ * partitions, once the statement's where clause has been applied to it.
+ * Partitions are split over num_threads threads and consume may be called
+ * from any of them, but never from two at once for the same partition.
+ *
+ * An id range stops after the batch that reaches key_high. A column
+ * predicate skips the leaves whose zone map rules it out.
+ * */
+template<typename Consume>
+void select_batches(Statement *statement,
+                    std::vector<ScanPartition> &partitions,
+                    uint32_t num_threads,
+                    Consume consume) {
+  bool by_id = statement->filter == SELECT_ID_EQUALS
+      || statement->filter == SELECT_ID_BETWEEN;
+  bool by_column = statement->filter == SELECT_COLUMN_EQUALS;
+
+  StringPattern pattern{};
+  if (by_column) {
+    pattern = string_pattern(statement->match, statement->text_value);
+  }
+  ZoneMapColumn zone_map_column = statement->column == INDEX_COLUMN_USERNAME
+                                  ? ZONE_MAP_USERNAME : ZONE_MAP_EMAIL;
+  auto leaf_may_match = [&](std::byte *leaf) {
+    if (!by_column) {
+      return true;
+    }
+    switch (statement->match) {
+      case STRING_MATCH_EQUALS:
+        return leaf_node_zone_map_may_contain(leaf, zone_map_column,
+                                              statement->text_value);
+      case STRING_MATCH_PREFIX:
+        return leaf_node_zone_map_may_have_prefix(leaf, zone_map_column,
+                                                  pattern.bytes,
+                                                  pattern.length);
+      case STRING_MATCH_CONTAINS:
+        break;
+    }
+    return true;
+  };
+
+  table_parallel_scan(partitions, num_threads,
+                      [&](uint32_t partition_num,
+                          Cursor *cursor,
+                          uint32_t end_page_num) {
+    RowBatch batch;
+    cursor_skip_exhausted_leaf(cursor);
+    while (batch_load(cursor, batch, leaf_may_match, end_page_num)) {
+      if (by_id) {
+        batch_filter_id_range(batch, statement->key_low, statement->key_high);
+      } else if (by_column && statement->column == INDEX_COLUMN_USERNAME) {
+        batch_filter_username(batch, pattern);
+      } else if (by_column) {
+        batch_filter_email(batch, pattern);
+      }
+      consume(partition_num, batch);
+      if (by_id && batch.ids[batch.size - 1] >= statement->key_high) {
+        break;
+      }
+    }
+  });
+}
+
+/*
+ * Print the rows select_batches finds.
+ *
+ * Each partition's rows are kept in its own buffer and printed in
+ * partition order once all threads are done, so the output is in key order
+ * as a single threaded scan would give it. An unordered scan prints every
+ * batch as soon as it is filtered instead.
+ * */
+ExecuteResult execute_select_scan(Statement *statement, Table *table) {
+  std::vector<ScanPartition> partitions = select_partitions(statement, table);
+  std::vector<std::ostringstream> outputs(partitions.size());
+  std::mutex output_mutex;
+
+  select_batches(statement, partitions, table->scan_threads,
+                 [&](uint32_t partition_num, RowBatch &batch) {
+    std::ostringstream &out = outputs[partition_num];
+    batch_print(batch, out);
+    if (statement->unordered) {
+      std::lock_guard<std::mutex> guard(output_mutex);
+      std::cout << out.str();
+      out.str("");
+    }
+  });
+
+  for (std::ostringstream &out: outputs) {
+    std::cout << out.str();
+  }
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Over the whole table count, min and max are read off the tree: the
+ * root's row counts and the ends of the leftmost and rightmost leaves.
+ * A sum or a where clause needs the rows, which every partition folds into
+ * its own state and the states are merged at the end.
+ * */
+ExecuteResult execute_select_aggregate(Statement *statement, Table *table) {
+  bool needs_rows = statement->filter != SELECT_ALL;
+  for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+    needs_rows |= statement->aggregates[i] == AGGREGATE_SUM;
+  }
+
+  AggregateState state = aggregate_init();
+  if (!needs_rows) {
+    state.count = table_row_count(table);
+    if (state.count > 0) {
+      std::byte *root = table->pager->get_page(table->root_page_num);
+      state.min = get_node_min_key(table->pager, root);
+      state.max = get_node_max_key(table->pager, root);
+    }
+  } else {
+    std::vector<ScanPartition> partitions =
+        select_partitions(statement, table);
+    std::vector<AggregateState> states(partitions.size(), aggregate_init());
+    select_batches(statement, partitions, table->scan_threads,
+                   [&](uint32_t partition_num, RowBatch &batch) {
+      aggregate_batch(states[partition_num], batch);
+    });
+    for (const AggregateState &partition_state: states) {
+      aggregate_merge(state, partition_state);
+    }
+  }
+
+  aggregate_print(state, statement->aggregates, statement->num_aggregates);
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Hash the group column of the rows select_batches finds into a GroupTable
+ * and print a row per distinct value, with its count for a group by, in
+ * no particular order. The table is filled from one thread, so the scan
+ * runs on one too; groups spill to temp pages past table->work_memory.
+ * */
+static_assert(SPILL_RECORD_HEADER_SIZE + EMAIL_SIZE
+                  <= PAGE_SIZE - SPILL_USED_SIZE,
+              "a spilled group has to fit in a temp page");
+
+ExecuteResult execute_select_group(Statement *statement, Table *table) {
+  GroupTable groups;
+  group_table_init(groups, table->pager, table->work_memory);
+
+  std::vector<ScanPartition> partitions = select_partitions(statement, table);
+  char email[EMAIL_SIZE];
+  select_batches(statement, partitions, 1,
+                 [&](uint32_t, RowBatch &batch) {
+    for (uint32_t i = 0; i < batch.num_selected; i++) {
+      RowView view = row_view(batch.rows[batch.selection[i]], batch.pager);
+      group_table_add(groups,
+                      statement->group_column == INDEX_COLUMN_USERNAME
+                      ? row_view_username(view) : row_view_email(view, email),
+                      1);
+    }
+  });
+
+  group_table_finish(groups, [&](std::string_view value, uint64_t count) {
+    std::cout << "(" << value;
+    if (statement->group_count) {
+      std::cout << ", " << count;
+    }
+    std::cout << ")" << std::endl;
+  });
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Rows in order of id, ascending or descending, up to the limit. A cursor
+ * walks the leaves from the low end of the where clause's id range, or
+ * for descending from its high end, or table_end, back with
+ * cursor_retreat, so "order by id desc limit N" reads about N rows however
+ * big the table is. A single id with an order by comes here too rather
+ * than through table_lookup, so its limit still applies.
+ * */
+ExecuteResult execute_select_by_key(Statement *statement, Table *table) {
+  bool by_id = statement->filter == SELECT_ID_EQUALS
+      || statement->filter == SELECT_ID_BETWEEN;
+  bool by_column = statement->filter == SELECT_COLUMN_EQUALS;
+  if (by_id && statement->key_low > statement->key_high) {
+    return EXECUTE_SUCCESS;
+  }
+
+  StringPattern pattern{};
+  if (by_column) {
+    pattern = string_pattern(statement->match, statement->text_value);
+  }
+
+  Cursor cursor{};
+  if (!statement->descending) {
+    cursor = by_id ? table_seek(table, statement->key_low)
+                   : table_start(table);
+    cursor_skip_exhausted_leaf(&cursor);
+  } else if (by_id) {
+    // The seek lands on key_high or on the first key past it.
+    cursor = table_seek(table, statement->key_high);
+    std::byte *leaf = table->pager->get_page(cursor.page_num);
+    if (cursor.cell_num == *leaf_node_num_cells(leaf)
+        || cursor_key(&cursor) > statement->key_high) {
+      cursor_retreat(&cursor);
+    }
+  } else {
+    cursor = table_end(table);
+    cursor_retreat(&cursor);
+  }
+
+  uint32_t limit = statement->sort_limited ? statement->limit : UINT32_MAX;
+  uint32_t count = 0;
+  while (count < limit && !(cursor.end_of_table)) {
+    RowView view = row_view(static_cast<std::byte *>(cursor_value(&cursor)),
+                            table->pager);
+    TableKey id = row_view_id(view);
+    if (by_id && (id < statement->key_low || id > statement->key_high)) {
+      break;
+    }
+
+    bool matches = !by_column
+        || (statement->column == INDEX_COLUMN_USERNAME
+            ? row_view_username_matches(view, pattern)
+            : row_view_email_matches(view, pattern));
+    if (matches) {
+      print_row_view(view);
+      count++;
+    }
+
+    if (statement->descending) {
+      cursor_retreat(&cursor);
+    } else {
+      cursor_advance(&cursor);
+    }
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Sort the rows select_batches finds on sort_column and print them in that
+ * order. Order by id needs no sort, see execute_select_by_key. Rows are
+ * handed to the Sorter from one thread, so the scan runs on one; past
+ * table->work_memory the sort goes through runs on temp pages.
+ * */
+ExecuteResult execute_select_sorted(Statement *statement, Table *table) {
+  if (statement->sort_by_key) {
+    return execute_select_by_key(statement, table);
+  }
+
+  Sorter sorter;
+  sorter_init(sorter, table->pager, table->work_memory,
+              statement->sort_column,
+              statement->sort_limited ? statement->limit : UINT32_MAX);
+
+  std::vector<ScanPartition> partitions = select_partitions(statement, table);
   Row row{};
-  while (!(cursor->end_of_table)) {
-    deserialize_row(static_cast<std::byte *>(cursor_value(cursor)), row);
-    print_row(row);
-    cursor_advance(cursor);
+  select_batches(statement, partitions, 1,
+                 [&](uint32_t, RowBatch &batch) {
+    for (uint32_t i = 0; i < batch.num_selected; i++) {
+      row_view_copy(row_view(batch.rows[batch.selection[i]], batch.pager),
+                    row);
+      sorter_add(sorter, row);
+    }
+  });
+
+  sorter_finish(sorter, [](const Row &sorted_row) {
+    print_row(sorted_row);
+  });
+  return EXECUTE_SUCCESS;
+}
+
+Index &table_index(Table *table, IndexColumn column) {
+  return column == INDEX_COLUMN_USERNAME ? table->username_index
+                                         : table->email_index;
+}
+
+/*
+ * With an index the matching ids are read off one run of index leaves and
+ * each row is fetched by a primary key seek. Without one, or for a prefix
+ * or contains match, every row has to be looked at.
+ * */
+ExecuteResult execute_select_column(Statement *statement, Table *table) {
+  Index &index = table_index(table, statement->column);
+
+  if (index.root_page_num == 0 || statement->match != STRING_MATCH_EQUALS) {
+    return execute_select_scan(statement, table);
   }
 
-  free(cursor);
+  std::byte entry[INDEX_MAX_ENTRY_SIZE];
+  index_make_entry(index, statement->text_value, 0, entry);
+  IndexCursor index_cursor = index_find(index, entry);
+  index_cursor_skip_exhausted_leaf(&index_cursor);
+
+  // Matching ids come out in increasing order, so each seek starts from
+  // the path of the previous one.
+  Cursor cursor{};
+  bool has_cursor = false;
+  while (!(index_cursor.end_of_index)) {
+    std::byte *found = index_cursor_entry(&index_cursor);
+    if (strncmp(index_entry_value(found),
+                statement->text_value,
+                index_key_size(index)) != 0) {
+      break;
+    }
+
+    TableKey id = index_entry_id(index, found);
+    if (!has_cursor) {
+      cursor = table_find(table, id);
+      has_cursor = true;
+    } else {
+      cursor_seek(&cursor, id);
+    }
+    print_row_view(row_view(static_cast<std::byte *>(cursor_value(&cursor)),
+                            table->pager));
+
+    index_cursor_advance(&index_cursor);
+  }
 
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_insert(Statement *statement, Table *table) {
-  std::byte *node = table->pager->get_page(table->root_page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+/*
+ * Jump to row number offset using the subtree counts, then read limit rows.
+ * */
+ExecuteResult execute_select_limit(Statement *statement, Table *table) {
+  Cursor cursor = table_find_row(table, statement->offset);
+  for (uint32_t i = 0; i < statement->limit && !(cursor.end_of_table); i++) {
+    print_row_view(row_view(static_cast<std::byte *>(cursor_value(&cursor)),
+                            table->pager));
+    cursor_advance(&cursor);
+  }
 
-  uint32_t key_to_insert = statement->row_to_insert.id;
-  Cursor *cursor = table_find(table, key_to_insert);
+  return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_select(Statement *statement, Table *table) {
+  // count(*) alone comes from the root, which counts buffered rows too.
+  if (statement->num_aggregates == 1
+      && statement->aggregates[0] == AGGREGATE_COUNT
+      && statement->filter == SELECT_ALL) {
+    std::cout << "(" << table_row_count(table) << ")" << std::endl;
+    return EXECUTE_SUCCESS;
+  }
 
-  // This means that the key already exists.
-  if (cursor->cell_num < num_cells) {
-    uint32_t key_at_index = *(leaf_node_key(node, cursor->cell_num));
-    if (key_to_insert == key_at_index) {
-      return EXECUTE_DUPLICATE_KEY;
+  // A point lookup prints the row as is. A group or distinct prints it
+  // through execute_select_group, and an order by may limit it away.
+  if (statement->filter == SELECT_ID_EQUALS
+      && statement->num_aggregates == 0 && !statement->grouped
+      && !statement->sorted) {
+    Row row{};
+    if (table_lookup(table, statement->key_low, row)) {
+      print_row(row);
     }
+    return EXECUTE_SUCCESS;
+  }
+
+  // Everything else walks the leaves, so buffered rows have to be there.
+  table_flush_buffer(table);
+
+  if (statement->grouped) {
+    return execute_select_group(statement, table);
+  }
+
+  if (statement->sorted) {
+    return execute_select_sorted(statement, table);
+  }
+
+  if (statement->num_aggregates > 0) {
+    return execute_select_aggregate(statement, table);
+  }
+
+  if (statement->filter == SELECT_LIMIT) {
+    return execute_select_limit(statement, table);
+  }
+
+  if (statement->filter == SELECT_COLUMN_EQUALS) {
+    return execute_select_column(statement, table);
   }
 
+  return execute_select_scan(statement, table);
+}
+
+/*
+ * Pages writing one row may take from the pager: the overflow pages of the
+ * longest email, a leaf split and a new root in the table, and in each
+ * index a split on every level of at most three and a new root. The pager
+ * cannot grow past TABLE_MAX_PAGES, so a write is refused unless that many
+ * are left free or below the limit.
+ * */
+constexpr uint32_t ROW_WRITE_MAX_NEW_PAGES =
+    overflow_max_new_pages(EMAIL_SIZE - EMAIL_INLINE_SIZE) + 2 + 2 * 4;
+
+bool table_has_room_for_row(Table *table) {
+  return table->pager->get_num_unused_pages() >= ROW_WRITE_MAX_NEW_PAGES;
+}
+
+ExecuteResult execute_insert(Statement *statement, Table *table) {
   Row *row_to_insert = &(statement->row_to_insert);
+  if (!table_has_room_for_row(table)) {
+    return EXECUTE_TABLE_FULL;
+  }
+  if (!table_insert(table, row_to_insert->id, row_to_insert)) {
+    return EXECUTE_DUPLICATE_KEY;
+  }
+
+  if (table->username_index.root_page_num != 0) {
+    index_insert(table->username_index,
+                 row_to_insert->username,
+                 row_to_insert->id);
+  }
+  if (table->email_index.root_page_num != 0) {
+    index_insert(table->email_index, row_to_insert->email, row_to_insert->id);
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Rewrite the assigned columns of one row in place. Index entries are keyed
+ * on the column value, so a changed value moves its entry.
+ * */
+ExecuteResult execute_update(Statement *statement, Table *table) {
+  if (!table_has_room_for_row(table)) {
+    return EXECUTE_TABLE_FULL;
+  }
+
+  Row row{};
+  if (!table_lookup(table, statement->key_low, row)) {
+    return EXECUTE_SUCCESS;
+  }
+
+  Row old_row = row;
+  if (statement->set_username) {
+    memcpy(row.username, statement->row_to_insert.username,
+           sizeof(row.username));
+  }
+  if (statement->set_email) {
+    memcpy(row.email, statement->row_to_insert.email, sizeof(row.email));
+  }
+
+  if (!table_update(table, row.id, &row)) {
+    return EXECUTE_SUCCESS;
+  }
+
+  if (table->username_index.root_page_num != 0
+      && strcmp(old_row.username, row.username) != 0) {
+    index_delete(table->username_index, old_row.username, row.id);
+    index_insert(table->username_index, row.username, row.id);
+  }
+  if (table->email_index.root_page_num != 0
+      && strcmp(old_row.email, row.email) != 0) {
+    index_delete(table->email_index, old_row.email, row.id);
+    index_insert(table->email_index, row.email, row.id);
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Allocate the index tree and fill it from a full scan of the table.
+ * */
+ExecuteResult execute_create_index(Statement *statement, Table *table) {
+  Index &index = table_index(table, statement->column);
+  if (index.root_page_num != 0) {
+    return EXECUTE_INDEX_EXISTS;
+  }
+  if (!index_column_fits(statement->column)) {
+    return EXECUTE_COLUMN_TOO_WIDE;
+  }
+
+  index_create(index, table->pager, statement->column);
+  table_flush_buffer(table);
+
+  Row row{};
+  for (std::byte *value: table_rows(table)) {
+    deserialize_row(value, row, table->pager);
+    index_insert(index,
+                 statement->column == INDEX_COLUMN_USERNAME ? row.username
+                                                            : row.email,
+                 row.id);
+  }
 
-  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
   return EXECUTE_SUCCESS;
 }
 
@@ -135,34 +1038,75 @@ ExecuteResult execute_statement(Statement *statement, Table *table) {
     case STATEMENT_SELECT:
       std::cout << "This is where do would do a select." << std::endl;
       return execute_select(statement, table);
+
+    case STATEMENT_CREATE_INDEX:
+      return execute_create_index(statement, table);
+
+    case STATEMENT_UPDATE:
+      return execute_update(statement, table);
   }
 }
 
 Table *db_open(const char *filename) {
   Pager *pager = new Pager(filename);
-  Table *table = static_cast<Table *>(malloc(sizeof(Table)));
+  auto *table = new Table{};
   table->pager = pager;
-  table->root_page_num = 0;
 
   if (pager->get_num_pages() == 0) {
-    // New database file. Initialize page 0 as leaf node.
-    std::byte *root_node = pager->get_page(0);
+    // New database file. Page 0 is the header, page 1 the root leaf node.
+    std::byte *header = pager->get_page(HEADER_PAGE_NUM);
+    memset(header, 0, PAGE_SIZE);
+    *header_root_page_num(header) = 1;
+
+    std::byte *root_node = pager->get_page(1);
     initialize_leaf_node(root_node);
+    set_node_root(root_node, true);
   }
 
+  std::byte *header = pager->get_page(HEADER_PAGE_NUM);
+  table->root_page_num = *header_root_page_num(header);
+  table->rightmost_leaf_page_num = 0;
+  table->username_index = {pager, *header_username_index_root(header),
+                           INDEX_COLUMN_USERNAME};
+  table->email_index = {pager, *header_email_index_root(header),
+                        INDEX_COLUMN_EMAIL};
+  table->write_buffering = *header_write_buffering(header) != 0;
+  pager->set_overflow_page_num(*header_overflow_page_num(header));
+  for (uint32_t i = 0; i < *header_num_free_pages(header); i++) {
+    pager->free_page(*header_free_page(header, i));
+  }
+  table->scan_threads = default_scan_threads();
+  table->work_memory = DEFAULT_WORK_MEMORY;
+
   return table;
 }
 
 void db_close(Table *table) {
   Pager *pager = table->pager;
 
+  std::byte *header = pager->get_page(HEADER_PAGE_NUM);
+  *header_root_page_num(header) = table->root_page_num;
+  *header_username_index_root(header) = table->username_index.root_page_num;
+  *header_email_index_root(header) = table->email_index.root_page_num;
+  *header_write_buffering(header) = table->write_buffering;
+  *header_overflow_page_num(header) = pager->get_overflow_page_num();
+  uint32_t num_free_pages = 0;
+  for (uint32_t page_num: pager->get_free_pages()) {
+    *header_free_page(header, num_free_pages++) = page_num;
+  }
+  *header_num_free_pages(header) = num_free_pages;
+
   std::cout << "Closing DB " << pager->get_num_pages() << std::endl;
   for (uint32_t i = 0; i < pager->get_num_pages(); i++) {
+    // Pages never read since open are unchanged on disk.
+    if (!pager->is_page_cached(i)) {
+      continue;
+    }
     std::cout << "Flushing page: " << i << std::endl;
     pager->flush(i);
   }
 
-  free(table);
+  delete table;
 }
 
 int main(int argc, char *argv[]) {
@@ -173,6 +1117,7 @@ int main(int argc, char *argv[]) {
 
   const char *filename = argv[1];
   Table *table = db_open(filename);
+  Arena statement_arena{};
 
   while (true) {
     print_prompt();
@@ -192,13 +1137,16 @@ int main(int argc, char *argv[]) {
     }
 
     Statement statement{};
-    switch (prepare_statement(user_text, &statement)) {
+    switch (prepare_statement(user_text, &statement, statement_arena)) {
 
       case PREPARE_SUCCESS:
         break;
       case PREPARE_SYNTAX_ERROR:
         std::cout << "Syntax error. Could not parse statement." << std::endl;
         continue;
+      case PREPARE_STRING_TOO_LONG:
+        std::cout << "String is too long." << std::endl;
+        continue;
       case PREPARE_UNRECOGNIZED_STATEMENT:
         std::cout << "Unrecognized keyword at the start of " << user_text
                   << std::endl;
@@ -215,6 +1163,12 @@ int main(int argc, char *argv[]) {
       case EXECUTE_TABLE_FULL:
         std::cout << "Error: Table full." << std::endl;
         break;
+      case EXECUTE_INDEX_EXISTS:
+        std::cout << "Error: Index already exists." << std::endl;
+        break;
+      case EXECUTE_COLUMN_TOO_WIDE:
+        std::cout << "Error: Column too wide to index." << std::endl;
+        break;
     }
   }
 }
@@ -0,0 +1,156 @@
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <tuple>
+#include <vector>
+#include "../Cursor.h"
+
+/*
+ * The table tree on keys other than the row id.
+ *
+ * Every other key of a sorted list is inserted in random order, enough to
+ * split leaves, once with FixedKey strings of different lengths and once
+ * with (tenant, id) CompositeKeys. Each inserted key has to be found by a
+ * lookup, and none of the keys left out. A seek to any key has to land on
+ * it, or on the next inserted one, and a scan from the start has to visit
+ * the inserted keys in order.
+ * */
+const char *TEST_DB = "key_test.db";
+const uint32_t NUM_KEYS = 1000;
+
+using StringKey = FixedKey<16>;
+using TenantKey = CompositeKey<uint32_t, uint64_t>;
+
+Table *test_table_open() {
+  unlink(TEST_DB);
+  auto *table = new Table{};
+  table->pager = new Pager(TEST_DB);
+  std::byte *header = table->pager->get_page(HEADER_PAGE_NUM);
+  memset(header, 0, PAGE_SIZE);
+  std::byte *root = table->pager->get_page(1);
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+  table->root_page_num = 1;
+  return table;
+}
+
+/*
+ * Decimal numbers unpadded, so "1" < "10" < "100" < "11" once sorted and
+ * shorter keys rely on their zero padding.
+ * */
+std::vector<StringKey> test_string_keys() {
+  std::vector<StringKey> keys(NUM_KEYS);
+  for (uint32_t i = 0; i < NUM_KEYS; i++) {
+    memset(keys[i].bytes, 0, sizeof(keys[i].bytes));
+    snprintf(keys[i].bytes, sizeof(keys[i].bytes), "%u", i);
+  }
+  return keys;
+}
+
+/*
+ * Ids go up across tenants, so sorting by tenant first interleaves them.
+ * */
+std::vector<TenantKey> test_tenant_keys() {
+  std::vector<TenantKey> keys(NUM_KEYS);
+  for (uint32_t i = 0; i < NUM_KEYS; i++) {
+    keys[i] = {i % 7, i * 13};
+  }
+  return keys;
+}
+
+/*
+ * The order the keys should have, worked out without KeyTraits.
+ * */
+bool test_less(const StringKey &a, const StringKey &b) {
+  return strncmp(a.bytes, b.bytes, sizeof(a.bytes)) < 0;
+}
+
+bool test_less(const TenantKey &a, const TenantKey &b) {
+  return std::tie(a.first, a.second) < std::tie(b.first, b.second);
+}
+
+/*
+ * Inserts keys[i] for every even i, with row id i, and checks lookups,
+ * seeks and the scan against the sorted keys.
+ * */
+template<typename Key>
+bool test_tree(const char *name, std::vector<Key> keys) {
+  std::sort(keys.begin(), keys.end(), [](const Key &a, const Key &b) {
+    return test_less(a, b);
+  });
+  Table *table = test_table_open();
+  bool ok = true;
+
+  std::vector<uint32_t> order;
+  for (uint32_t i = 0; i < NUM_KEYS; i += 2) {
+    order.push_back(i);
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937(5));
+  for (uint32_t i: order) {
+    Row row{};
+    row.id = i;
+    snprintf(row.username, USERNAME_SIZE, "user%u", i);
+    ok = table_insert<Key>(table, keys[i], &row) && ok;
+  }
+  Row duplicate{};
+  ok = !table_insert<Key>(table, keys[0], &duplicate) && ok;
+  if (!ok) {
+    std::cerr << name << ": inserts failed" << std::endl;
+  }
+
+  for (uint32_t i = 0; i < NUM_KEYS; i++) {
+    Row row{};
+    bool found = table_lookup<Key>(table, keys[i], row);
+    if (found != (i % 2 == 0) || (found && row.id != i)) {
+      std::cerr << name << ": lookup of " << keys[i] << " failed"
+                << std::endl;
+      ok = false;
+    }
+  }
+
+  for (uint32_t i = 0; i < NUM_KEYS; i++) {
+    Cursor cursor = table_seek<Key>(table, keys[i]);
+    cursor_skip_exhausted_leaf<Key>(&cursor);
+    uint32_t expected = i + i % 2;
+    if (expected == NUM_KEYS ? !cursor.end_of_table
+                             : cursor.end_of_table
+            || !key_equal(cursor_key<Key>(&cursor), keys[expected])) {
+      std::cerr << name << ": seek to " << keys[i] << " failed"
+                << std::endl;
+      ok = false;
+    }
+  }
+
+  uint32_t expected = 0;
+  for (Cursor cursor = table_start<Key>(table); !cursor.end_of_table;
+       cursor_advance<Key>(&cursor)) {
+    Row row{};
+    deserialize_row(static_cast<std::byte *>(cursor_value<Key>(&cursor)),
+                    row, table->pager);
+    if (expected >= NUM_KEYS
+        || !key_equal(cursor_key<Key>(&cursor), keys[expected])
+        || row.id != expected) {
+      std::cerr << name << ": scan out of order at " << expected
+                << std::endl;
+      ok = false;
+      break;
+    }
+    expected += 2;
+  }
+  ok = ok && expected == NUM_KEYS
+      && table_row_count<Key>(table) == NUM_KEYS / 2;
+
+  unlink(TEST_DB);
+  return ok;
+}
+
+int main() {
+  // The tree code logs every split to stdout.
+  std::cout.setstate(std::ios::failbit);
+
+  bool ok = test_tree("fixed key", test_string_keys());
+  ok = test_tree("composite key", test_tenant_keys()) && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
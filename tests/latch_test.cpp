@@ -0,0 +1,253 @@
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../Cursor.h"
+
+/*
+ * Readers against writers on the table's version latches.
+ *
+ * Updates rewrite the same few rows over and over, bumping the version of
+ * their leaf and of the root every time, while reader threads look those
+ * rows up. Lookups that overlap an update have to fail validation and start
+ * over; a lookup that returns must never see a row half written, i.e. a
+ * username and email from different updates. Then two writer threads
+ * insert, splitting leaves under the readers, and every row that was in the
+ * table before a lookup began has to be found by it. Last, .compact
+ * rebuilds the tree over and over at different fill factors while the
+ * readers look up every row, none of which may go missing meanwhile.
+ * */
+const char *TEST_DB = "latch_test.db";
+const uint32_t NUM_READERS = 4;
+const uint32_t NUM_HOT_ROWS = 8;
+const uint32_t NUM_INSERTS = 600;
+const auto MAX_UPDATE_TIME = std::chrono::seconds(10);
+const uint64_t WANTED_RESTARTS = 100;
+const uint32_t NUM_COMPACTIONS = 20;
+
+Table *test_table_open() {
+  unlink(TEST_DB);
+  auto *table = new Table{};
+  table->pager = new Pager(TEST_DB);
+  std::byte *header = table->pager->get_page(HEADER_PAGE_NUM);
+  memset(header, 0, PAGE_SIZE);
+  std::byte *root = table->pager->get_page(1);
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+  table->root_page_num = 1;
+  return table;
+}
+
+/*
+ * Row id at generation: the same generation in both columns, and a long
+ * email on odd generations so the overflow path is read under the latch
+ * as well.
+ * */
+Row test_row(TableKey id, uint64_t generation) {
+  Row row{};
+  row.id = id;
+  snprintf(row.username, USERNAME_SIZE, "%lu", generation);
+  snprintf(row.email, EMAIL_SIZE, "%lu@%0*d", generation,
+           generation % 2 == 1 ? 100 : 1, 0);
+  return row;
+}
+
+bool test_row_consistent(const Row &row, TableKey id) {
+  uint64_t generation = strtoull(row.username, nullptr, 10);
+  Row expected = test_row(id, generation);
+  return row.id == id && strcmp(row.email, expected.email) == 0;
+}
+
+bool test_latch_primitives() {
+  PageLatch latch;
+  uint64_t version = latch_read_begin(latch);
+  bool ok = latch_read_validate(latch, version);
+
+  latch_write_lock(latch);
+  ok = ok && !latch_read_validate(latch, version);
+  latch_write_unlock(latch);
+  ok = ok && !latch_read_validate(latch, version);
+  ok = ok && !latch_try_upgrade(latch, version);
+
+  version = latch_read_begin(latch);
+  ok = ok && latch_try_upgrade(latch, version);
+  latch_write_unlock(latch);
+  return ok;
+}
+
+bool test_readers_against_updates(Table *table) {
+  for (TableKey id = 0; id < NUM_HOT_ROWS; id++) {
+    Row row = test_row(id, 0);
+    table_insert(table, id, &row);
+  }
+
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> bad{0};
+  auto reader = [&](uint32_t seed) {
+    std::mt19937 random(seed);
+    while (!done.load()) {
+      TableKey id = random() % NUM_HOT_ROWS;
+      Row row{};
+      if (!table_lookup(table, id, row) || !test_row_consistent(row, id)) {
+        bad++;
+      }
+    }
+  };
+
+  table->lookup_restarts = 0;
+  std::vector<std::thread> readers;
+  for (uint32_t i = 0; i < NUM_READERS; i++) {
+    readers.emplace_back(reader, i);
+  }
+  auto deadline = std::chrono::steady_clock::now() + MAX_UPDATE_TIME;
+  for (uint64_t generation = 1;
+       table->lookup_restarts.load() < WANTED_RESTARTS
+           && std::chrono::steady_clock::now() < deadline; generation++) {
+    TableKey id = generation % NUM_HOT_ROWS;
+    Row row = test_row(id, generation);
+    table_update(table, id, &row);
+  }
+  done = true;
+  for (std::thread &thread: readers) {
+    thread.join();
+  }
+
+  std::cerr << "updates: " << table->lookup_restarts.load()
+            << " lookup restarts, " << bad.load() << " bad reads"
+            << std::endl;
+  return bad.load() == 0 && table->lookup_restarts.load() > 0;
+}
+
+bool test_readers_against_inserts(Table *table) {
+  std::vector<TableKey> keys;
+  for (TableKey i = 0; i < NUM_INSERTS; i++) {
+    keys.push_back(NUM_HOT_ROWS + i * 7);
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(3));
+
+  std::vector<std::atomic<bool>> inserted(NUM_INSERTS);
+  std::atomic<uint32_t> next{0};
+  std::atomic<uint32_t> writers_left{2};
+  std::atomic<uint64_t> bad{0};
+  auto writer = [&]() {
+    uint32_t i;
+    while ((i = next++) < NUM_INSERTS) {
+      Row row = test_row(keys[i], 0);
+      if (!table_insert(table, keys[i], &row)) {
+        bad++;
+      }
+      inserted[(keys[i] - NUM_HOT_ROWS) / 7] = true;
+    }
+    writers_left--;
+  };
+  auto reader = [&](uint32_t seed) {
+    std::mt19937 random(seed);
+    while (writers_left.load() > 0) {
+      uint32_t i = random() % NUM_INSERTS;
+      TableKey id = NUM_HOT_ROWS + i * 7;
+      bool was_inserted = inserted[i].load();
+      Row row{};
+      bool found = table_lookup(table, id, row);
+      if ((was_inserted && !found)
+          || (found && !test_row_consistent(row, id))) {
+        bad++;
+      }
+    }
+  };
+
+  table->lookup_restarts = 0;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < NUM_READERS; i++) {
+    threads.emplace_back(reader, i);
+  }
+  threads.emplace_back(writer);
+  threads.emplace_back(writer);
+  for (std::thread &thread: threads) {
+    thread.join();
+  }
+
+  for (TableKey key: keys) {
+    Row row{};
+    if (!table_lookup(table, key, row)) {
+      bad++;
+    }
+  }
+  std::cerr << "inserts: " << table->lookup_restarts.load()
+            << " lookup restarts, " << bad.load() << " bad reads"
+            << std::endl;
+  return bad.load() == 0
+      && table_row_count(table) == NUM_HOT_ROWS + NUM_INSERTS;
+}
+
+bool test_readers_against_compaction(Table *table) {
+  std::vector<TableKey> keys;
+  for (TableKey id = 0; id < NUM_HOT_ROWS; id++) {
+    keys.push_back(id);
+  }
+  for (TableKey i = 0; i < NUM_INSERTS; i++) {
+    keys.push_back(NUM_HOT_ROWS + i * 7);
+  }
+
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> bad{0};
+  auto reader = [&](uint32_t seed) {
+    std::mt19937 random(seed);
+    while (!done.load()) {
+      TableKey id = keys[random() % keys.size()];
+      Row row{};
+      if (!table_lookup(table, id, row) || !test_row_consistent(row, id)) {
+        bad++;
+      }
+    }
+  };
+
+  table->lookup_restarts = 0;
+  std::vector<std::thread> readers;
+  for (uint32_t i = 0; i < NUM_READERS; i++) {
+    readers.emplace_back(reader, i);
+  }
+  uint32_t failed_compactions = 0;
+  auto deadline = std::chrono::steady_clock::now() + MAX_UPDATE_TIME;
+  for (uint32_t i = 0;
+       i < NUM_COMPACTIONS
+           || (table->lookup_restarts.load() < WANTED_RESTARTS
+               && std::chrono::steady_clock::now() < deadline); i++) {
+    if (!table_compact(table, i % 2 == 0 ? 100 : 50)) {
+      failed_compactions++;
+    }
+  }
+  done = true;
+  for (std::thread &thread: readers) {
+    thread.join();
+  }
+
+  std::cerr << "compaction: " << table->lookup_restarts.load()
+            << " lookup restarts, " << bad.load() << " bad reads, "
+            << failed_compactions << " failed compactions, "
+            << table->pager->get_num_pages() << " pages" << std::endl;
+  return bad.load() == 0 && failed_compactions == 0
+      && table->lookup_restarts.load() > 0
+      && table_row_count(table) == keys.size();
+}
+
+int main() {
+  // The tree code logs every split to stdout.
+  std::cout.setstate(std::ios::failbit);
+
+  bool ok = test_latch_primitives();
+  if (!ok) {
+    std::cerr << "latch primitives failed" << std::endl;
+  }
+
+  Table *table = test_table_open();
+  ok = test_readers_against_updates(table) && ok;
+  ok = test_readers_against_inserts(table) && ok;
+  ok = test_readers_against_compaction(table) && ok;
+
+  unlink(TEST_DB);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,202 @@
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../Cursor.h"
+
+/*
+ * Overflow chains and rows with long emails.
+ *
+ * Values from empty to several pages long are written to overflow slots
+ * and read, compared and printed back; the longest has to chain across
+ * more than one page. Rewriting a value reuses its chain, and short tails
+ * still pack many to a page. Then rows whose emails take a chain are
+ * inserted into the table, looked up and scanned in order. Built with a
+ * COLUMN_EMAIL_SIZE of several slots, so the rows chain as well.
+ * */
+const char *TEST_DB = "overflow_test.db";
+const uint32_t NUM_ROWS = 30;
+
+Table *test_table_open() {
+  unlink(TEST_DB);
+  auto *table = new Table{};
+  table->pager = new Pager(TEST_DB);
+  std::byte *header = table->pager->get_page(HEADER_PAGE_NUM);
+  memset(header, 0, PAGE_SIZE);
+  std::byte *root = table->pager->get_page(1);
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+  table->root_page_num = 1;
+  return table;
+}
+
+std::string test_value(uint32_t length, uint32_t seed) {
+  std::string value(length, ' ');
+  for (uint32_t i = 0; i < length; i++) {
+    value[i] = static_cast<char>('a' + (i * 7 + seed) % 26);
+  }
+  return value;
+}
+
+/*
+ * Pages the first length bytes of the chain starting at slot are on.
+ * */
+std::set<uint32_t> test_chain_pages(Pager *pager,
+                                    uint32_t slot,
+                                    uint32_t length) {
+  std::set<uint32_t> pages;
+  while (length > 0) {
+    pages.insert(slot / OVERFLOW_SLOTS_PER_PAGE);
+    length -= std::min(length, OVERFLOW_SLOT_DATA_SIZE);
+    slot = *overflow_slot_next(overflow_slot(pager, slot));
+  }
+  return pages;
+}
+
+bool test_value_reads_back(Pager *pager,
+                           uint32_t slot,
+                           const std::string &value) {
+  std::string read(value.size(), ' ');
+  overflow_read(pager, slot, read.data(), value.size());
+
+  std::ostringstream printed;
+  overflow_print(printed, pager, slot, value.size());
+
+  bool ok = read == value && printed.str() == value
+      && overflow_equals(pager, slot, value.data(), value.size());
+  if (!value.empty()) {
+    std::string other = value;
+    other.back() = other.back() == 'a' ? 'b' : 'a';
+    ok = ok && !overflow_equals(pager, slot, other.data(), other.size());
+  }
+  return ok;
+}
+
+bool test_chain_lengths(Pager *pager) {
+  bool ok = true;
+  for (uint32_t length: {0u, 1u, OVERFLOW_SLOT_DATA_SIZE,
+                         OVERFLOW_SLOT_DATA_SIZE + 1, 1000u, 5000u, 20000u}) {
+    std::string value = test_value(length, length);
+    uint32_t slot = overflow_write(pager, value.data(), length, 0);
+    if ((length == 0) != (slot == 0)
+        || !test_value_reads_back(pager, slot, value)) {
+      std::cerr << "value of " << length << " bytes read back wrong"
+                << std::endl;
+      ok = false;
+    }
+  }
+
+  std::string value = test_value(20000, 1);
+  uint32_t slot = overflow_write(pager, value.data(), value.size(), 0);
+  if (test_chain_pages(pager, slot, value.size()).size() < 2) {
+    std::cerr << "a value longer than a page stayed on one page"
+              << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+bool test_rewrite(Pager *pager) {
+  std::string value = test_value(5000, 2);
+  uint32_t slot = overflow_write(pager, value.data(), value.size(), 0);
+  uint32_t num_pages = pager->get_num_pages();
+
+  std::string shorter = test_value(100, 3);
+  bool ok = overflow_write(pager, shorter.data(), shorter.size(), slot) == slot
+      && test_value_reads_back(pager, slot, shorter);
+
+  std::string longer = test_value(5000, 4);
+  ok = ok && overflow_write(pager, longer.data(), longer.size(), slot) == slot
+      && test_value_reads_back(pager, slot, longer)
+      && pager->get_num_pages() == num_pages;
+
+  std::string longest = test_value(9000, 5);
+  ok = ok && overflow_write(pager, longest.data(), longest.size(), slot) == slot
+      && test_value_reads_back(pager, slot, longest);
+  if (!ok) {
+    std::cerr << "rewritten value read back wrong or took new pages"
+              << std::endl;
+  }
+  return ok;
+}
+
+bool test_small_tails_pack(Pager *pager) {
+  // Start from a fresh overflow page.
+  pager->set_overflow_page_num(0);
+  std::set<uint32_t> pages;
+  for (uint32_t i = 0; i < OVERFLOW_SLOTS_PER_PAGE; i++) {
+    std::string value = test_value(10, i);
+    uint32_t slot = overflow_write(pager, value.data(), value.size(), 0);
+    pages.insert(slot / OVERFLOW_SLOTS_PER_PAGE);
+  }
+  if (pages.size() != 1) {
+    std::cerr << OVERFLOW_SLOTS_PER_PAGE << " short tails took "
+              << pages.size() << " pages" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Row id, with an email of a length that differs from row to row and is
+ * the longest there can be for every tenth.
+ * */
+Row test_row(TableKey id) {
+  Row row{};
+  row.id = id;
+  snprintf(row.username, USERNAME_SIZE, "user%lu", id);
+  uint32_t length = id % 10 == 0 ? EMAIL_SIZE - 1 : id * 131 % EMAIL_SIZE;
+  std::string email = test_value(length, id);
+  memcpy(row.email, email.data(), length);
+  return row;
+}
+
+bool test_row_equal(const Row &a, const Row &b) {
+  return a.id == b.id && strcmp(a.username, b.username) == 0
+      && strncmp(a.email, b.email, EMAIL_SIZE) == 0;
+}
+
+bool test_table_rows(Table *table) {
+  bool ok = true;
+  // Out of order, so rows move between leaves as they split.
+  for (TableKey i = 0; i < NUM_ROWS; i++) {
+    TableKey id = i * 17 % NUM_ROWS;
+    Row row = test_row(id);
+    ok = table_insert(table, id, &row) && ok;
+  }
+
+  for (TableKey id = 0; id < NUM_ROWS; id++) {
+    Row row{};
+    ok = table_lookup(table, id, row) && test_row_equal(row, test_row(id))
+        && ok;
+  }
+
+  TableKey expected_id = 0;
+  Row row{};
+  for (std::byte *value: table_rows(table)) {
+    deserialize_row(value, row, table->pager);
+    ok = test_row_equal(row, test_row(expected_id++)) && ok;
+  }
+  ok = ok && expected_id == NUM_ROWS;
+  if (!ok) {
+    std::cerr << "rows with long emails read back wrong" << std::endl;
+  }
+  return ok;
+}
+
+int main() {
+  // The tree and the pager log to stdout.
+  std::cout.setstate(std::ios::failbit);
+
+  Table *table = test_table_open();
+  bool ok = test_chain_lengths(table->pager);
+  ok = test_rewrite(table->pager) && ok;
+  ok = test_small_tails_pack(table->pager) && ok;
+  ok = test_table_rows(table) && ok;
+
+  unlink(TEST_DB);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
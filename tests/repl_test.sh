@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Statements run through the REPL against a small table, checked on the
+# rows they print. Usage: repl_test.sh <rk_sqllite binary>
+#
+BINARY="$1"
+DB="${TMPDIR:-/tmp}/repl_test.$$.db"
+FAILED=0
+
+# check <name> <statement> <expected rows, one per line>
+check() {
+  rm -f "$DB"
+  ACTUAL=$( (printf 'insert 3 u3 e3@x\ninsert 4 u4 e4@x\ninsert 5 u3 e5@x\n'
+             printf '%s\n.exit\n' "$2") | "$BINARY" "$DB" | grep '^(')
+  if [ "$ACTUAL" != "$3" ]; then
+    echo "FAILED $1: $2"
+    echo "expected:"
+    echo "$3"
+    echo "got:"
+    echo "$ACTUAL"
+    FAILED=1
+  fi
+}
+
+check "distinct by id" \
+  "select distinct username where id = 3" \
+  "(u3)"
+check "group by id" \
+  "select username, count(*) where id = 3 group by username" \
+  "(u3, 1)"
+check "order by column, limit 0, by id" \
+  "select where id = 3 order by username limit 0" \
+  ""
+check "order by column by id" \
+  "select where id = 3 order by username limit 1" \
+  "(3, u3, e3@x)"
+check "order by id, limit 0, by id" \
+  "select where id = 3 order by id limit 0" \
+  ""
+check "order by id desc, limit 0, by id" \
+  "select where id = 4 order by id desc limit 0" \
+  ""
+check "order by id desc by id" \
+  "select where id = 4 order by id desc limit 1" \
+  "(4, u4, e4@x)"
+check "order by id, missing id" \
+  "select where id = 2 order by id" \
+  ""
+
+rm -f "$DB"
+exit $FAILED